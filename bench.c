@@ -0,0 +1,383 @@
+// Shlomi Ben-Shushan
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Defines status codes.
+#define SUCCESS     0
+#define ERROR       -1
+
+// Defines the outcomes a synthetic submission can be written for, and their default mix (weights, in
+// the order of outcomes), number of submissions and output size in KB.
+#define OUTCOMES        6
+#define DEFAULT_MIX     "60,10,15,10,1,4"
+#define DEFAULT_COUNT   200
+#define DEFAULT_SIZE    16
+
+// Defines the files of a benchmark tree, relative to its directory.
+#define TREE    "./bench.XXXXXX"    // mkdtemp() template of the tree, unless -d names one.
+#define INPUT   "input.txt"
+#define CORRECT "correct.txt"
+#define CONFIG  "conf.txt"
+#define SUMMARY "summary.txt"       // What ex32 prints -- the summary table of the trace among it.
+#define TRACE   "trace.json"
+#define RESULTS "results.csv"
+
+// Defines the command line synopsis.
+#define USAGE   "Usage: bench [-n COUNT] [-m IDENTICAL,SIMILAR,WRONG,COMPILE,TIMEOUT,MISSING] [-k KB] " \
+                "[-e EX32] [-d DIR] [-- ex32 options]\n"
+
+// The outcomes, by the verdict ex32 should give them, and the program that is written for each. Every
+// program reads the number of lines from its input, and the correct output is "line N" for each of
+// them. The submission's number is passed as %d, so no two sources are the same (and the compilation
+// cache can't grade them all from one entry).
+const char *outcomes[OUTCOMES] = {"EXCELLENT", "SIMILAR", "WRONG", "COMPILATION_ERROR", "TIMEOUT", "NO_C_FILE"};
+const char *programs[OUTCOMES] = {
+    "// Submission %d.\n#include <stdio.h>\n"
+    "int main() { int n; scanf(\"%%d\", &n); for (int i = 0; i < n; ++i) printf(\"line %%d\\n\", i); }\n",
+    "// Submission %d.\n#include <stdio.h>\n"
+    "int main() { int n; scanf(\"%%d\", &n); for (int i = 0; i < n; ++i) printf(\"LINE  %%d\\n\", i); }\n",
+    "// Submission %d.\n#include <stdio.h>\n"
+    "int main() { int n; scanf(\"%%d\", &n); for (int i = 0; i < n; ++i) printf(\"line %%d\\n\", i + 1); }\n",
+    "// Submission %d.\nint main() { return 0 }\n",
+    "// Submission %d.\n#include <unistd.h>\nint main() { for (;;) pause(); }\n",
+    "Submission %d forgot to hand in the C file.\n"
+};
+
+/**********************************************************************************
+* Function:     print
+* Input:        String.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the given string to the standard output.
+***********************************************************************************/
+int print(const char *msg) {
+    if (write(1, msg, strlen(msg)) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     writeFile
+* Input:        A path, a printf() format and its arguments.
+* Output:       0 for success, -1 for error.
+* Operation:    Creates the file (or truncates it) with the formatted text.
+***********************************************************************************/
+__attribute__((format(printf, 2, 3)))
+int writeFile(const char *path, const char *format, ...) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    int status = vfprintf(file, format, arguments) < 0 ? ERROR : SUCCESS;
+    va_end(arguments);
+    if (fclose(file) == EOF) {
+        status = ERROR;
+    }
+    return status;
+}
+
+/**********************************************************************************
+* Function:     generateTree
+* Input:        The tree's directory, the number of submissions, the weight of
+*               every outcome, and the size of the correct output in KB, and an
+*               array for the number of submissions of every outcome.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes a configuration file, an input and its correct output
+*               (about KB of "line N" lines), and a sub-directory for every
+*               submission. Every outcome gets its share of the submissions by
+*               its weight (what rounding leaves goes to the first outcome), and
+*               the submissions of the outcomes are interleaved by their names.
+***********************************************************************************/
+int generateTree(const char *directory, int count, const int *weights, int kb, int *expected) {
+
+    // Enter the tree.
+    if (chdir(directory) == ERROR) {
+        print("Error in: chdir\n");
+        return ERROR;
+    }
+
+    // Share the submissions between the outcomes.
+    int total = 0, given = 0;
+    for (int i = 0; i < OUTCOMES; ++i) {
+        total += weights[i];
+    }
+    for (int i = 0; i < OUTCOMES; ++i) {
+        expected[i] = total ? (int)((long)count * weights[i] / total) : 0;
+        given += expected[i];
+    }
+    expected[0] += count - given;
+
+    // Write the input, the correct output and the configuration.
+    int lines = 0;
+    FILE *correct = fopen(CORRECT, "w");
+    if (correct == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    for (long written = 0; written < (long)kb << 10; ++lines) {
+        written += fprintf(correct, "line %d\n", lines);
+    }
+    if (fclose(correct) == EOF || writeFile(INPUT, "%d\n", lines) == ERROR
+        || writeFile(CONFIG, "submissions\n%s\n%s\n", INPUT, CORRECT) == ERROR) {
+        return ERROR;
+    }
+
+    // Write the submissions, taking the outcomes in turns.
+    if (mkdir("submissions", S_IRWXU) == ERROR) {
+        print("Error in: mkdir\n");
+        return ERROR;
+    }
+    int left[OUTCOMES];
+    memcpy(left, expected, sizeof(left));
+    for (int i = 0, outcome = 0; i < count; ++i) {
+        while (left[outcome] == 0) {
+            outcome = (outcome + 1) % OUTCOMES;
+        }
+        --left[outcome];
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "submissions/student%06d", i);
+        if (mkdir(path, S_IRWXU) == ERROR) {
+            print("Error in: mkdir\n");
+            return ERROR;
+        }
+        strcat(path, outcome == OUTCOMES - 1 ? "/README.txt" : "/main.c");
+        if (writeFile(path, programs[outcome], i) == ERROR) {
+            return ERROR;
+        }
+        outcome = (outcome + 1) % OUTCOMES;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     runGrader
+* Input:        The path of ex32 and the options to pass it, and pointers for the
+*               wall time in seconds and the peak RSS in KB.
+* Output:       0 for success, -1 for error.
+* Operation:    Runs ex32 with a trace on the tree (the working directory), with
+*               its output in SUMMARY. The peak RSS is the largest of ex32 and of
+*               every process it waited for -- gcc and the graded programs too.
+***********************************************************************************/
+int runGrader(const char *grader, char **options, int optionCount, double *seconds, long *peakRss) {
+
+    // Build the command -- ex32 --trace TRACE [options] CONFIG.
+    char *command[optionCount + 5];
+    command[0] = (char *)grader;
+    command[1] = "--trace";
+    command[2] = TRACE;
+    for (int i = 0; i < optionCount; ++i) {
+        command[3 + i] = options[i];
+    }
+    command[3 + optionCount] = CONFIG;
+    command[4 + optionCount] = NULL;
+
+    // Run it and wait for it.
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open(SUMMARY, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == ERROR || dup2(fd, 1) == ERROR) {
+            _exit(ERROR);
+        }
+        execvp(command[0], command);
+        print("Error in: execvp\n");
+        _exit(ERROR);
+    }
+    if (pid < 0) {
+        print("Error in: fork\n");
+        return ERROR;
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == ERROR) {
+        print("Error in: wait4\n");
+        return ERROR;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    *peakRss = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != SUCCESS) {
+        print("ex32 failed, see " SUMMARY "\n");
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     report
+* Input:        The number of submissions, the number expected of every outcome,
+*               the wall time and the peak RSS.
+* Output:       0 for success, -1 for error.
+* Operation:    Prints the benchmark as one JSON object in a line, so runs can be
+*               compared by a pipeline: the throughput, the peak RSS, the phases
+*               of the summary table ex32 printed (count, and total, p50, p95 and
+*               p99 in milliseconds) and, for every outcome, how many submissions
+*               were written for it and how many ex32 gave its verdict.
+***********************************************************************************/
+int report(int count, const int *expected, double seconds, long peakRss) {
+
+    printf("{\"submissions\":%d,\"seconds\":%.3f,\"submissions_per_second\":%.2f,\"peak_rss_kb\":%ld,"
+           "\"phases\":{", count, seconds, seconds > 0 ? count / seconds : 0, peakRss);
+
+    // Copy the phases from the summary table.
+    FILE *summary = fopen(SUMMARY, "r");
+    if (summary == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    char line[256], phase[16];
+    int phases = 0, phaseCount;
+    double total, p50, p95, p99;
+    while (fgets(line, sizeof(line), summary) != NULL) {
+        if (sscanf(line, "%15s %d %lf %lf %lf %lf", phase, &phaseCount, &total, &p50, &p95, &p99) == 6) {
+            printf("%s\"%s\":{\"count\":%d,\"total_ms\":%.1f,\"p50_ms\":%.1f,\"p95_ms\":%.1f,\"p99_ms\":%.1f}",
+                   phases++ ? "," : "", phase, phaseCount, total, p50, p95, p99);
+        }
+    }
+    fclose(summary);
+
+    // Count the verdicts of the results.
+    int verdicts[OUTCOMES] = {0};
+    FILE *results = fopen(RESULTS, "r");
+    if (results == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    while (fgets(line, sizeof(line), results) != NULL) {
+        char *reason = strchr(line, ',');
+        reason = reason != NULL ? strchr(reason + 1, ',') : NULL;
+        for (int i = 0; reason != NULL && i < OUTCOMES; ++i) {
+            size_t length = strlen(outcomes[i]);
+            if (!strncmp(reason + 1, outcomes[i], length) && strchr(",\n", reason[1 + length]) != NULL) {
+                ++verdicts[i];
+            }
+        }
+    }
+    fclose(results);
+    printf("},\"outcomes\":{");
+    for (int i = 0; i < OUTCOMES; ++i) {
+        printf("%s\"%s\":{\"expected\":%d,\"graded\":%d}", i ? "," : "", outcomes[i], expected[i], verdicts[i]);
+    }
+    printf("}}\n");
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     removeEntry
+* Input:        nftw() style.
+* Output:       0 for success, -1 for error.
+* Operation:    Removes a file or an (already emptied) directory.
+***********************************************************************************/
+int removeEntry(const char *path, const struct stat *entry, int type, struct FTW *ftw) {
+    (void)entry;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/**********************************************************************************
+* Function:     main
+* Input:        argc, argv -- standard input:
+*               [-n COUNT] [-m IDENTICAL,SIMILAR,WRONG,COMPILE,TIMEOUT,MISSING]
+*               [-k KB] [-e EX32] [-d DIR] [-- ex32 options].
+* Output:       0 if finished properly, or exit with code -1 if a problem occured.
+* Operation:    End-to-end benchmark of ex32. Generates a tree of COUNT (200 by
+*               default) synthetic submissions, with a mix of outcomes by the
+*               given weights (60,10,15,10,1,4 by default) and a correct output of
+*               about KB (16 by default), grades it with EX32 (./a.out by default)
+*               and the options after --, and prints the report (see report()).
+*               The tree is generated in a temporary directory and removed at the
+*               end, unless -d names a directory to generate it in and keep.
+***********************************************************************************/
+int main(int argc, char **argv) {
+
+    // Parse options.
+    int count = DEFAULT_COUNT, kb = DEFAULT_SIZE, weights[OUTCOMES];
+    const char *mix = DEFAULT_MIX, *directory = NULL;
+    char *grader = "./a.out";
+    int option;
+    while ((option = getopt(argc, argv, "n:m:k:e:d:")) != -1) {
+        if (option == 'n') {
+            count = strtol(optarg, NULL, 10);
+        } else if (option == 'm') {
+            mix = optarg;
+        } else if (option == 'k') {
+            kb = strtol(optarg, NULL, 10);
+        } else if (option == 'e') {
+            grader = optarg;
+        } else if (option == 'd') {
+            directory = optarg;
+        } else {
+            print(USAGE);
+            exit(ERROR);
+        }
+    }
+    if (count < 1 || kb < 0 || sscanf(mix, "%d,%d,%d,%d,%d,%d", &weights[0], &weights[1], &weights[2],
+                                      &weights[3], &weights[4], &weights[5]) != OUTCOMES) {
+        print(USAGE);
+        exit(ERROR);
+    }
+
+    // ex32 runs in the tree, so it needs an absolute path (unless it is found in PATH).
+    if (strchr(grader, '/') != NULL && (grader = realpath(grader, NULL)) == NULL) {
+        print("Error in: realpath\n");
+        exit(ERROR);
+    }
+
+    // Create the tree.
+    char temporary[] = TREE;
+    char *tree = directory != NULL ? realpath(directory, NULL) : NULL;
+    if (directory != NULL ? tree == NULL : (tree = mkdtemp(temporary)) == NULL) {
+        print("Error in: mkdtemp\n");
+        exit(ERROR);
+    }
+    if (directory == NULL && (tree = realpath(tree, NULL)) == NULL) {
+        print("Error in: realpath\n");
+        exit(ERROR);
+    }
+    int expected[OUTCOMES];
+    if (generateTree(tree, count, weights, kb, expected) == ERROR) {
+        exit(ERROR);
+    }
+
+    // Grade it, and report.
+    double seconds;
+    long peakRss;
+    int status = runGrader(grader, argv + optind, argc - optind, &seconds, &peakRss);
+    if (status == SUCCESS) {
+        status = report(count, expected, seconds, peakRss);
+    }
+
+    // Remove the tree, unless it was asked for.
+    if (directory == NULL && (chdir("/") == ERROR || nftw(tree, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == ERROR)) {
+        print("Error in: nftw\n");
+        status = ERROR;
+    }
+    free(tree);
+    if (status != SUCCESS) {
+        exit(ERROR);
+    }
+    return SUCCESS;
+
+}
@@ -0,0 +1,1334 @@
+// Shlomi Ben-Shushan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "comparator.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
+
+// Define reader tuning -- files of at least MAP_MIN bytes are mapped, others are read in blocks.
+#define BLOCK_SIZE  (1 << 20)
+#define MAP_MIN     (1 << 16)
+
+// Define how many raw bytes are normalized at a time, and the spare room the kernels may write past
+// the end of their output.
+#define STREAM_CHUNK (1 << 16)
+#define STREAM_SLACK 32
+
+// Define the rules of normalization (see setNormalization()) -- the bytes it ignores, and whether it folds
+// ASCII case -- and the rules it follows unless told otherwise.
+#define RULE_SPACE      0x01
+#define RULE_NEWLINE    0x02
+#define RULE_TAB        0x04
+#define RULE_RETURN     0x08
+#define RULE_BLANK      0x10
+#define RULE_CASE       0x20
+#define RULES_DEFAULT   (RULE_SPACE | RULE_NEWLINE | RULE_CASE)
+
+// Define when a comparison is split between threads -- both files are in memory and have at least
+// PARALLEL_MIN bytes -- and the most threads it is split between.
+#define PARALLEL_MIN            (1 << 26)
+#define PARALLEL_MAX_THREADS    16
+
+/**********************************************************************************
+* Struct:       Reader
+* Operation:    A block-oriented view of a file or of a memory buffer. Buffers and
+*               regular files that are large enough (mapped to memory) are handed
+*               out as one block, anything else (small files, pipes, devices) is
+*               read into a buffer BLOCK_SIZE bytes at a time. Consumers walk
+*               block[offset..length) and call fillReader() whenever the current
+*               block is exhausted. start is where the file was when it was opened.
+***********************************************************************************/
+typedef struct {
+    int fd;
+    off_t start;
+    const unsigned char *block;
+    size_t length;
+    size_t offset;
+    const unsigned char *memory;
+    size_t memoryLength;
+    void *map;
+    unsigned char *buffer;
+    struct stat info;
+} Reader;
+
+/**********************************************************************************
+* Function:     openMemoryReader
+* Input:        Reader *reader - the reader to initialize, a buffer and its length.
+* Output:       None.
+* Operation:    Sets a reader over a buffer that stays owned by the caller.
+***********************************************************************************/
+static void openMemoryReader(Reader *reader, const void *data, size_t length) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+    reader->memory = length > 0 ? data : (const void *)"";
+    reader->memoryLength = length;
+}
+
+/**********************************************************************************
+* Function:     mapRest
+* Input:        int fd - File Descriptor of a regular file, its size, its current
+*               offset, and a pointer for the mapping.
+* Output:       The first byte of the rest of the file, or NULL for error.
+* Operation:    Maps the file from its current offset to its end. mmap() takes
+*               page-aligned offsets only, so the mapping starts at the page of the
+*               offset (see unmapRest()).
+***********************************************************************************/
+static const unsigned char *mapRest(int fd, off_t size, off_t start, void **map) {
+    off_t base = start - start % sysconf(_SC_PAGESIZE);
+    *map = mmap(NULL, size - base, PROT_READ, MAP_PRIVATE, fd, base);
+    if (*map == MAP_FAILED) {
+        *map = NULL;
+        return NULL;
+    }
+    return (const unsigned char *)*map + (start - base);
+}
+
+/**********************************************************************************
+* Function:     unmapRest
+* Input:        A mapping of mapRest(), the rest it returned, and its length.
+* Output:       None.
+* Operation:    Unmaps the whole mapping, the part before the offset included.
+***********************************************************************************/
+static void unmapRest(void *map, const unsigned char *rest, size_t length) {
+    munmap(map, rest - (const unsigned char *)map + length);
+}
+
+/**********************************************************************************
+* Function:     openReader
+* Input:        Reader *reader - the reader to initialize, int fd - File Descriptor.
+* Output:       0 for success, -1 for error.
+* Operation:    Chooses a reading strategy according to the file's type and size.
+*               Regular files with at least MAP_MIN bytes left past their current
+*               offset are mapped from that offset with a sequential access hint,
+*               all the others get a BLOCK_SIZE buffer and are read from it.
+***********************************************************************************/
+static int openReader(Reader *reader, int fd) {
+
+    // Start with an empty block, so the first fillReader() call loads data.
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1) {
+        return -1;
+    }
+    reader->info = fileStat;
+
+    // Map the rest of big regular files. If mapping fails for some reason, fall back to buffered reads.
+    if (S_ISREG(fileStat.st_mode)) {
+        reader->start = lseek(fd, 0, SEEK_CUR);
+        if (reader->start != -1 && fileStat.st_size - reader->start >= MAP_MIN) {
+            void *map;
+            const unsigned char *rest = mapRest(fd, fileStat.st_size, reader->start, &map);
+            if (rest != NULL) {
+                reader->map = map;
+                reader->memory = rest;
+                reader->memoryLength = fileStat.st_size - reader->start;
+                madvise(map, rest - (const unsigned char *)map + reader->memoryLength, MADV_SEQUENTIAL);
+                return 0;
+            }
+        }
+    }
+
+    // Tell the kernel regular files are read sequentially, so it reads ahead aggressively.
+    if (S_ISREG(fileStat.st_mode)) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    reader->buffer = malloc(BLOCK_SIZE);
+    if (reader->buffer == NULL) {
+        return -1;
+    }
+    return 0;
+
+}
+
+/**********************************************************************************
+* Function:     fillReader
+* Input:        Reader *reader - an open reader whose current block is consumed.
+* Output:       1 if a new block is available, 0 at end of file, -1 for error.
+* Operation:    Loads the next block. A buffer or a mapped file is handed out as a
+*               single block, a buffered file is read with one read() call per block.
+***********************************************************************************/
+static int fillReader(Reader *reader) {
+
+    reader->offset = 0;
+    reader->length = 0;
+
+    // A buffer or a mapped file has exactly one block -- the whole memory.
+    if (reader->memory != NULL) {
+        if (reader->block != NULL) {
+            return 0;
+        }
+        reader->block = reader->memory;
+        reader->length = reader->memoryLength;
+        return 1;
+    }
+
+    // Buffered file -- retry reads interrupted by signals.
+    ssize_t received;
+    do {
+        received = read(reader->fd, reader->buffer, BLOCK_SIZE);
+    } while (received == -1 && errno == EINTR);
+    if (received == -1) {
+        return -1;
+    }
+    reader->block = reader->buffer;
+    reader->length = received;
+    return received > 0;
+
+}
+
+/**********************************************************************************
+* Function:     closeReader
+* Input:        Reader *reader - an open reader.
+* Output:       None.
+* Operation:    Releases the mapping or the buffer of the reader. The file
+*               descriptor or the memory itself belongs to the caller and is left
+*               as is.
+***********************************************************************************/
+static void closeReader(Reader *reader) {
+    if (reader->map != NULL) {
+        unmapRest(reader->map, reader->memory, reader->memoryLength);
+    }
+    free(reader->buffer);
+}
+
+/**********************************************************************************
+* Function:     mismatchScalar
+* Input:        Two byte arrays and their common length.
+* Output:       The offset of the first different byte, or length if none.
+* Operation:    Portable kernel -- compares 8 bytes at a time and scans the first
+*               differing word byte by byte.
+***********************************************************************************/
+static size_t mismatchScalar(const unsigned char *a, const unsigned char *b, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y)
+            break;
+    }
+    while (i < length && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+#ifdef X86_KERNELS
+
+/**********************************************************************************
+* Function:     mismatchSSE2
+* Input:        Two byte arrays and their common length.
+* Output:       The offset of the first different byte, or length if none.
+* Operation:    Compares 16 bytes per step and locates the first different byte
+*               from the equality mask.
+***********************************************************************************/
+__attribute__((target("sse2")))
+static size_t mismatchSSE2(const unsigned char *a, const unsigned char *b, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + mismatchScalar(a + i, b + i, length - i);
+}
+
+/**********************************************************************************
+* Function:     mismatchAVX2
+* Input:        Two byte arrays and their common length.
+* Output:       The offset of the first different byte, or length if none.
+* Operation:    Compares 64 bytes per step (two 32 byte lanes) and locates the first
+*               different byte only once a step reports a difference.
+***********************************************************************************/
+__attribute__((target("avx2")))
+static size_t mismatchAVX2(const unsigned char *a, const unsigned char *b, size_t length) {
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y0 = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(a + i + 32));
+        __m256i y1 = _mm256_loadu_si256((const __m256i *)(b + i + 32));
+        __m256i equal = _mm256_and_si256(_mm256_cmpeq_epi8(x0, y0), _mm256_cmpeq_epi8(x1, y1));
+        if ((unsigned)_mm256_movemask_epi8(equal) != 0xFFFFFFFFu) {
+            unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, y0));
+            if (mask)
+                return i + __builtin_ctz(mask);
+            mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, y1));
+            return i + 32 + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatchSSE2(a + i, b + i, length - i);
+}
+
+#endif
+
+/**********************************************************************************
+* Tables:       foldTable, keepTable, compactTable, skipLow, skipHigh, foldBit
+* Operation:    foldTable maps every byte to the byte similarity compares it as
+*               (its upper-case form, by default), and keepTable holds 0 for the
+*               bytes similarity ignores (' ' and '\n', by default) and 1 for all
+*               the others. compactTable[mask] lists the positions of the set bits
+*               of an 8 bit mask, and is used as a shuffle control that packs the
+*               kept bytes of 8 lanes to the front. skipLow and skipHigh classify
+*               a byte by its nibbles with two shuffles -- it is ignored if
+*               skipLow[byte & 15] & skipHigh[byte >> 4] isn't 0 -- and foldBit is
+*               the bit folding clears from lower-case letters (0 for none). Built
+*               by selectKernels() from the rules.
+***********************************************************************************/
+static unsigned char foldTable[256];
+static unsigned char keepTable[256];
+static unsigned char compactTable[256][8];
+static unsigned char skipLow[16];
+static unsigned char skipHigh[16];
+static unsigned char foldBit;
+
+// The rules of normalization (see setNormalization()).
+static unsigned normalizationRules = RULES_DEFAULT;
+
+/**********************************************************************************
+* Function:     normalizeScalar
+* Input:        Source bytes, their length and an output array.
+* Output:       The number of bytes written to dst.
+* Operation:    Portable kernel -- writes the folded form of every byte and
+*               advances the output only over kept bytes, so there is no branch
+*               per byte. dst needs room for length + 1 bytes.
+***********************************************************************************/
+static size_t normalizeScalar(const unsigned char *src, size_t length, unsigned char *dst) {
+    unsigned char *out = dst;
+    for (size_t i = 0; i < length; ++i) {
+        *out = foldTable[src[i]];
+        out += keepTable[src[i]];
+    }
+    return out - dst;
+}
+
+/**********************************************************************************
+* Function:     countScalar
+* Input:        Source bytes and their length.
+* Output:       The number of bytes normalization keeps.
+* Operation:    Portable kernel -- sums keepTable over the bytes.
+***********************************************************************************/
+static size_t countScalar(const unsigned char *src, size_t length) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; ++i)
+        count += keepTable[src[i]];
+    return count;
+}
+
+#ifdef X86_KERNELS
+
+/**********************************************************************************
+* Function:     compact16
+* Input:        16 folded bytes, a mask of the bytes to keep, and an output pointer.
+* Output:       The output pointer advanced past the kept bytes.
+* Operation:    Packs the kept bytes of each 8 byte half with a compactTable shuffle
+*               and stores them. Each store writes 8 bytes, so up to 8 bytes past
+*               the returned pointer are overwritten.
+***********************************************************************************/
+__attribute__((target("sse4.2,popcnt")))
+static inline unsigned char *compact16(__m128i bytes, unsigned keep, unsigned char *out) {
+    unsigned low = keep & 0xFF, high = (keep >> 8) & 0xFF;
+    __m128i control = _mm_loadl_epi64((const __m128i *)compactTable[low]);
+    _mm_storel_epi64((__m128i *)out, _mm_shuffle_epi8(bytes, control));
+    out += __builtin_popcount(low);
+    control = _mm_add_epi8(_mm_loadl_epi64((const __m128i *)compactTable[high]), _mm_set1_epi8(8));
+    _mm_storel_epi64((__m128i *)out, _mm_shuffle_epi8(bytes, control));
+    return out + __builtin_popcount(high);
+}
+
+/**********************************************************************************
+* Function:     keepMask16
+* Input:        16 bytes, the nibble tables (see skipLow and skipHigh), and whether
+*               to classify by them or by the default rules.
+* Output:       A mask of the bytes to keep.
+* Operation:    The default rules find spaces and line-breaks with two equality
+*               masks. Any other rules look both nibbles of every byte up with a
+*               shuffle, and ignore the bytes whose classes share a bit. table is
+*               a constant in every caller, so each gets the branch it needs only.
+***********************************************************************************/
+__attribute__((target("sse4.2,popcnt"), always_inline))
+static inline unsigned keepMask16(__m128i bytes, __m128i low, __m128i high, const int table) {
+    if (!table) {
+        __m128i skip = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                    _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+        return _mm_movemask_epi8(skip) ^ 0xFFFF;
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i lowClass = _mm_shuffle_epi8(low, _mm_and_si128(bytes, nibble));
+    __m128i highClass = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lowClass, highClass), _mm_setzero_si128()));
+}
+
+/**********************************************************************************
+* Function:     keepMask32
+* Input:        32 bytes, the nibble tables in both lanes, and whether to classify
+*               by them or by the default rules.
+* Output:       A mask of the bytes to keep.
+* Operation:    Same as keepMask16(), 32 bytes at a time.
+***********************************************************************************/
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline unsigned keepMask32(__m256i bytes, __m256i low, __m256i high, const int table) {
+    if (!table) {
+        __m256i skip = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+        return ~(unsigned)_mm256_movemask_epi8(skip);
+    }
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i lowClass = _mm256_shuffle_epi8(low, _mm256_and_si256(bytes, nibble));
+    __m256i highClass = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    __m256i zero = _mm256_setzero_si256();
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lowClass, highClass), zero));
+}
+
+/**********************************************************************************
+* Function:     normalizeWithSSE42
+* Input:        Source bytes, their length, an output array, and whether to follow
+*               the tables or the default rules.
+* Output:       The number of bytes written to dst.
+* Operation:    Classifies and folds 16 bytes per step -- the bytes to keep are
+*               found with keepMask16(), lower-case letters with one signed range
+*               compare -- and packs the kept bytes with compact16(). dst needs
+*               room for length + STREAM_SLACK bytes.
+***********************************************************************************/
+__attribute__((target("sse4.2,popcnt"), always_inline))
+static inline size_t normalizeWithSSE42(const unsigned char *src, size_t length, unsigned char *dst,
+                                        const int table) {
+    const __m128i low = _mm_loadu_si128((const __m128i *)skipLow);
+    const __m128i high = _mm_loadu_si128((const __m128i *)skipHigh);
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a')), bound = _mm_set1_epi8(-128 + 26);
+    const __m128i caseBit = _mm_set1_epi8(table ? foldBit : 0x20);
+    unsigned char *out = dst;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned keep = keepMask16(bytes, low, high, table);
+        __m128i lower = _mm_cmpgt_epi8(bound, _mm_add_epi8(bytes, shift));
+        bytes = _mm_sub_epi8(bytes, _mm_and_si128(lower, caseBit));
+        if (keep == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)out, bytes);
+            out += 16;
+        } else if (keep) {
+            out = compact16(bytes, keep, out);
+        }
+    }
+    return (out - dst) + normalizeScalar(src + i, length - i, out);
+}
+
+/**********************************************************************************
+* Function:     normalizeWithAVX2
+* Input:        Source bytes, their length, an output array, and whether to follow
+*               the tables or the default rules.
+* Output:       The number of bytes written to dst.
+* Operation:    Same as normalizeWithSSE42(), but classifies and folds 32 bytes per
+*               step, and stores runs without ignored bytes as they are. dst needs
+*               room for length + STREAM_SLACK bytes.
+***********************************************************************************/
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline size_t normalizeWithAVX2(const unsigned char *src, size_t length, unsigned char *dst,
+                                       const int table) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skipLow));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skipHigh));
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a')), bound = _mm256_set1_epi8(-128 + 26);
+    const __m256i caseBit = _mm256_set1_epi8(table ? foldBit : 0x20);
+    unsigned char *out = dst;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned keep = keepMask32(bytes, low, high, table);
+        __m256i lower = _mm256_cmpgt_epi8(bound, _mm256_add_epi8(bytes, shift));
+        bytes = _mm256_sub_epi8(bytes, _mm256_and_si256(lower, caseBit));
+        if (keep == 0xFFFFFFFFu) {
+            _mm256_storeu_si256((__m256i *)out, bytes);
+            out += 32;
+        } else if (keep) {
+            out = compact16(_mm256_castsi256_si128(bytes), keep & 0xFFFF, out);
+            out = compact16(_mm256_extracti128_si256(bytes, 1), keep >> 16, out);
+        }
+    }
+    return (out - dst) + normalizeWithSSE42(src + i, length - i, out, table);
+}
+
+/**********************************************************************************
+* Function:     countWithSSE42
+* Input:        Source bytes, their length, and whether to follow the tables or the
+*               default rules.
+* Output:       The number of bytes normalization keeps.
+* Operation:    Finds the bytes to keep 16 bytes per step, like
+*               normalizeWithSSE42(), and counts them with popcount.
+***********************************************************************************/
+__attribute__((target("sse4.2,popcnt"), always_inline))
+static inline size_t countWithSSE42(const unsigned char *src, size_t length, const int table) {
+    const __m128i low = _mm_loadu_si128((const __m128i *)skipLow);
+    const __m128i high = _mm_loadu_si128((const __m128i *)skipHigh);
+    size_t kept = 0, i = 0;
+    for (; i + 16 <= length; i += 16)
+        kept += __builtin_popcount(keepMask16(_mm_loadu_si128((const __m128i *)(src + i)), low, high, table));
+    return kept + countScalar(src + i, length - i);
+}
+
+/**********************************************************************************
+* Function:     countWithAVX2
+* Input:        Source bytes, their length, and whether to follow the tables or the
+*               default rules.
+* Output:       The number of bytes normalization keeps.
+* Operation:    Same as countWithSSE42(), 32 bytes per step.
+***********************************************************************************/
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline size_t countWithAVX2(const unsigned char *src, size_t length, const int table) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skipLow));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skipHigh));
+    size_t kept = 0, i = 0;
+    for (; i + 32 <= length; i += 32)
+        kept += __builtin_popcount(keepMask32(_mm256_loadu_si256((const __m256i *)(src + i)), low, high, table));
+    return kept + countWithSSE42(src + i, length - i, table);
+}
+
+// The kernels, specialized for the default rules and for any rules the nibble tables can describe.
+__attribute__((target("sse4.2,popcnt")))
+static size_t normalizeSSE42(const unsigned char *src, size_t length, unsigned char *dst) {
+    return normalizeWithSSE42(src, length, dst, 0);
+}
+__attribute__((target("sse4.2,popcnt")))
+static size_t normalizeTableSSE42(const unsigned char *src, size_t length, unsigned char *dst) {
+    return normalizeWithSSE42(src, length, dst, 1);
+}
+__attribute__((target("avx2,popcnt")))
+static size_t normalizeAVX2(const unsigned char *src, size_t length, unsigned char *dst) {
+    return normalizeWithAVX2(src, length, dst, 0);
+}
+__attribute__((target("avx2,popcnt")))
+static size_t normalizeTableAVX2(const unsigned char *src, size_t length, unsigned char *dst) {
+    return normalizeWithAVX2(src, length, dst, 1);
+}
+__attribute__((target("sse4.2,popcnt")))
+static size_t countSSE42(const unsigned char *src, size_t length) {
+    return countWithSSE42(src, length, 0);
+}
+__attribute__((target("sse4.2,popcnt")))
+static size_t countTableSSE42(const unsigned char *src, size_t length) {
+    return countWithSSE42(src, length, 1);
+}
+__attribute__((target("avx2,popcnt")))
+static size_t countAVX2(const unsigned char *src, size_t length) {
+    return countWithAVX2(src, length, 0);
+}
+__attribute__((target("avx2,popcnt")))
+static size_t countTableAVX2(const unsigned char *src, size_t length) {
+    return countWithAVX2(src, length, 1);
+}
+
+#endif
+
+// The kernels in use, chosen once by selectKernels().
+static size_t (*mismatch)(const unsigned char *, const unsigned char *, size_t) = mismatchScalar;
+static size_t (*normalize)(const unsigned char *, size_t, unsigned char *) = normalizeScalar;
+static size_t (*countKept)(const unsigned char *, size_t) = countScalar;
+
+// The number of threads a big comparison is split between (see compareParallel()), 1 for none.
+static int parallelThreads = 1;
+
+/**********************************************************************************
+* Function:     selectKernels
+* Input:        None.
+* Output:       None.
+* Operation:    Builds the normalization tables from the rules and picks the
+*               widest kernels the running CPU supports -- the ones specialized
+*               for the default rules, or else the ones that follow the nibble
+*               tables (if the ignored bytes have at most 8 distinct high nibbles,
+*               which any rules do). The environment variable COMP_KERNEL (scalar,
+*               sse2, sse4.2 or avx2) can force narrower ones, which is handy to
+*               cross-check the kernels against each other. Also picks a thread
+*               per online core for big comparisons, or as many as the environment
+*               variable COMP_THREADS says (1 turns them off).
+***********************************************************************************/
+static void selectKernels(void) {
+
+    // Build the tables -- by default, similarity ignores spaces and line-breaks, and ASCII case.
+    unsigned rules = normalizationRules;
+    foldBit = rules & RULE_CASE ? 0x20 : 0;
+    for (int ch = 0; ch < 256; ++ch) {
+        int blank = ch == ' ' || ('\t' <= ch && ch <= '\r');
+        int skip = ((rules & RULE_SPACE) && ch == ' ') || ((rules & RULE_NEWLINE) && ch == '\n')
+                   || ((rules & RULE_TAB) && ch == '\t') || ((rules & RULE_RETURN) && ch == '\r')
+                   || ((rules & RULE_BLANK) && blank);
+        foldTable[ch] = ('a' <= ch && ch <= 'z') ? ch - foldBit : ch;
+        keepTable[ch] = !skip;
+    }
+
+    // Give every high nibble of an ignored byte a bit of its own, as long as there are bits left.
+    int rows = 0;
+    memset(skipLow, 0, sizeof(skipLow));
+    memset(skipHigh, 0, sizeof(skipHigh));
+    for (int ch = 0; ch < 256; ++ch) {
+        if (!keepTable[ch]) {
+            if (skipHigh[ch >> 4] == 0 && rows < 8)
+                skipHigh[ch >> 4] = 1 << rows++;
+            skipLow[ch & 15] |= skipHigh[ch >> 4];
+        }
+    }
+    int described = 1;
+    for (int ch = 0; ch < 256; ++ch)
+        described &= ((skipLow[ch & 15] & skipHigh[ch >> 4]) == 0) == keepTable[ch];
+    for (int mask = 0; mask < 256; ++mask) {
+        int count = 0;
+        for (int bit = 0; bit < 8; ++bit)
+            if (mask & (1 << bit))
+                compactTable[mask][count++] = bit;
+        while (count < 8)
+            compactTable[mask][count++] = 0x80;
+    }
+
+    // Pick the threads.
+    const char *threads = getenv("COMP_THREADS");
+    parallelThreads = threads != NULL ? atoi(threads) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (parallelThreads < 1)
+        parallelThreads = 1;
+    if (parallelThreads > PARALLEL_MAX_THREADS)
+        parallelThreads = PARALLEL_MAX_THREADS;
+
+    // Pick the kernels.
+    const char *forced = getenv("COMP_KERNEL");
+    if (forced != NULL && !strcmp(forced, "scalar"))
+        return;
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    int allowAVX2 = forced == NULL || !strcmp(forced, "avx2");
+    int allowSSE42 = allowAVX2 || !strcmp(forced, "sse4.2");
+    int preset = rules == RULES_DEFAULT;
+    if (allowAVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        mismatch = mismatchAVX2;
+        if (preset || described) {
+            normalize = preset ? normalizeAVX2 : normalizeTableAVX2;
+            countKept = preset ? countAVX2 : countTableAVX2;
+        }
+    } else if (allowSSE42 && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        mismatch = mismatchSSE2;
+        if (preset || described) {
+            normalize = preset ? normalizeSSE42 : normalizeTableSSE42;
+            countKept = preset ? countSSE42 : countTableSSE42;
+        }
+    } else if (__builtin_cpu_supports("sse2")) {
+        mismatch = mismatchSSE2;
+    }
+#endif
+
+}
+
+/**********************************************************************************
+* Struct:       Stream
+* Operation:    The normalized form of a reader's remaining bytes -- spaces and
+*               line-breaks removed and letters folded to upper-case. It is
+*               produced STREAM_CHUNK raw bytes at a time into data[offset..length),
+*               and whatever one stream has left over is carried to the next
+*               comparison step, so whitespace doesn't have to line up between the
+*               two files at block boundaries.
+***********************************************************************************/
+typedef struct {
+    Reader *reader;
+    unsigned char *data;
+    size_t length;
+    size_t offset;
+} Stream;
+
+/**********************************************************************************
+* Function:     fillStream
+* Input:        Stream *stream - a stream whose normalized bytes are consumed.
+* Output:       1 if new bytes are available, 0 at end of file, -1 for error.
+* Operation:    Normalizes raw chunks until at least one byte is kept, so a run of
+*               whitespace of any length costs no more than a loop iteration per
+*               chunk.
+***********************************************************************************/
+static int fillStream(Stream *stream) {
+    Reader *reader = stream->reader;
+    stream->offset = 0;
+    stream->length = 0;
+    while (stream->length == 0) {
+        if (reader->offset == reader->length) {
+            int status = fillReader(reader);
+            if (status <= 0)
+                return status;
+        }
+        size_t count = reader->length - reader->offset;
+        if (count > STREAM_CHUNK)
+            count = STREAM_CHUNK;
+        stream->length = normalize(reader->block + reader->offset, count, stream->data);
+        reader->offset += count;
+    }
+    return 1;
+}
+
+/**********************************************************************************
+* Function:     findIdentity
+* Input:        Reader *src, Reader *dst - two open readers.
+* Output:       IDENTICAL, 0 if a difference was found, or READ_ERROR.
+* Operation:    The identity stage. Files of different sizes can never be
+*               identical, so for them the stage only locates the end of the common
+*               prefix. The readers are compared block by block with the mismatch
+*               kernel, and both are left positioned on the first pair of
+*               different bytes, which is where the similarity stage starts.
+***********************************************************************************/
+static int findIdentity(Reader *src, Reader *dst) {
+    for (;;) {
+
+        // Refill whichever reader ran out of bytes.
+        if (src->offset == src->length && fillReader(src) == -1)
+            return READ_ERROR;
+        if (dst->offset == dst->length && fillReader(dst) == -1)
+            return READ_ERROR;
+
+        // Compare the overlapping part of both blocks.
+        size_t srcLeft = src->length - src->offset;
+        size_t dstLeft = dst->length - dst->offset;
+        size_t count = srcLeft < dstLeft ? srcLeft : dstLeft;
+        if (count == 0)
+            return (srcLeft == 0 && dstLeft == 0) ? IDENTICAL : 0;
+        size_t i = mismatch(src->block + src->offset, dst->block + dst->offset, count);
+        src->offset += i;
+        dst->offset += i;
+        if (i < count)
+            return 0;
+    }
+
+}
+
+/**********************************************************************************
+* Function:     findSimilarity
+* Input:        Reader *src, Reader *dst - two open readers.
+* Output:       3 for similar, 2 for different, or READ_ERROR.
+* Operation:    The similarity stage. Compares the normalized streams of both
+*               readers with the mismatch kernel. The files are similar if both
+*               streams end together without a difference.
+***********************************************************************************/
+static int findSimilarity(Reader *src, Reader *dst) {
+
+    // Set a stream over each reader.
+    Stream srcStream = {src, malloc(STREAM_CHUNK + STREAM_SLACK), 0, 0};
+    Stream dstStream = {dst, malloc(STREAM_CHUNK + STREAM_SLACK), 0, 0};
+    int status = READ_ERROR;
+    if (srcStream.data == NULL || dstStream.data == NULL)
+        goto release;
+
+    for (;;) {
+
+        // Refill whichever stream ran out of bytes.
+        if (srcStream.offset == srcStream.length && fillStream(&srcStream) == -1)
+            goto release;
+        if (dstStream.offset == dstStream.length && fillStream(&dstStream) == -1)
+            goto release;
+
+        // If one file is completely read while the other contains more characters, they are different.
+        size_t srcLeft = srcStream.length - srcStream.offset;
+        size_t dstLeft = dstStream.length - dstStream.offset;
+        size_t count = srcLeft < dstLeft ? srcLeft : dstLeft;
+        if (count == 0) {
+            status = (srcLeft == 0 && dstLeft == 0) ? SIMILAR : DIFFERENT;
+            goto release;
+        }
+
+        // Else, compare the overlapping part of the streams and stop at a significant difference.
+        size_t i = mismatch(srcStream.data + srcStream.offset, dstStream.data + dstStream.offset, count);
+        if (i < count) {
+            status = DIFFERENT;
+            goto release;
+        }
+        srcStream.offset += count;
+        dstStream.offset += count;
+    }
+
+release:
+    free(srcStream.data);
+    free(dstStream.data);
+    return status;
+
+}
+
+/**********************************************************************************
+* Struct:       Parallel
+* Operation:    A comparison of two files in memory split between threads. The
+*               identity stage splits the common length, and leaves the offset of
+*               the first different byte in found. The similarity stage splits
+*               the rest of each file into STREAM_CHUNK blocks, counts the bytes
+*               every block keeps (turned into prefix sums, so count[b] is the
+*               normalized offset block b starts at), and then splits the
+*               normalized streams -- each thread locates its share in both files
+*               by the counts, so whitespace doesn't have to line up at any
+*               boundary.
+***********************************************************************************/
+typedef struct {
+    const unsigned char *src;
+    const unsigned char *dst;
+    size_t srcLength;
+    size_t dstLength;
+    size_t *srcCounts;
+    size_t *dstCounts;
+    size_t srcBlocks;
+    size_t dstBlocks;
+    size_t found;
+    int different;
+    int failed;
+    int threads;
+} Parallel;
+
+/**********************************************************************************
+* Struct:       Task
+* Operation:    The share of one thread in a parallel comparison.
+***********************************************************************************/
+typedef struct {
+    Parallel *job;
+    int index;
+} Task;
+
+/**********************************************************************************
+* Function:     runTasks
+* Input:        Parallel *job - a parallel comparison, the body of its tasks.
+* Output:       None.
+* Operation:    Runs a task per thread and waits for all of them. A task whose
+*               thread can't be created runs on the calling thread instead.
+***********************************************************************************/
+static void runTasks(Parallel *job, void *(*body)(void *)) {
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    Task tasks[PARALLEL_MAX_THREADS];
+    int created[PARALLEL_MAX_THREADS];
+    for (int i = 0; i < job->threads; ++i) {
+        tasks[i] = (Task){job, i};
+        created[i] = pthread_create(&threads[i], NULL, body, &tasks[i]) == 0;
+        if (!created[i])
+            body(&tasks[i]);
+    }
+    for (int i = 0; i < job->threads; ++i)
+        if (created[i])
+            pthread_join(threads[i], NULL);
+}
+
+/**********************************************************************************
+* Function:     identityTask
+* Input:        Task *task (as void *).
+* Output:       NULL.
+* Operation:    Compares the thread's share of the common length, a BLOCK_SIZE
+*               at a time, and lowers job->found to its first different byte.
+*               Gives up once another thread found a difference before its share.
+***********************************************************************************/
+static void *identityTask(void *argument) {
+    Task *task = argument;
+    Parallel *job = task->job;
+    size_t common = job->srcLength < job->dstLength ? job->srcLength : job->dstLength;
+    size_t begin = common / job->threads * task->index;
+    size_t end = task->index == job->threads - 1 ? common : common / job->threads * (task->index + 1);
+    while (begin < end && __atomic_load_n(&job->found, __ATOMIC_RELAXED) > begin) {
+        size_t count = end - begin < BLOCK_SIZE ? end - begin : BLOCK_SIZE;
+        size_t i = mismatch(job->src + begin, job->dst + begin, count);
+        if (i < count) {
+            size_t found = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+            while (begin + i < found && !__atomic_compare_exchange_n(&job->found, &found, begin + i, 0,
+                                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+            break;
+        }
+        begin += count;
+    }
+    return NULL;
+}
+
+/**********************************************************************************
+* Function:     countTask
+* Input:        Task *task (as void *).
+* Output:       NULL.
+* Operation:    Counts the bytes every block of the thread's share keeps, in both
+*               files.
+***********************************************************************************/
+static void *countTask(void *argument) {
+    Task *task = argument;
+    Parallel *job = task->job;
+    for (int f = 0; f < 2; ++f) {
+        const unsigned char *data = f == 0 ? job->src : job->dst;
+        size_t length = f == 0 ? job->srcLength : job->dstLength;
+        size_t blocks = f == 0 ? job->srcBlocks : job->dstBlocks;
+        size_t *counts = f == 0 ? job->srcCounts : job->dstCounts;
+        size_t end = blocks * (task->index + 1) / job->threads;
+        for (size_t b = blocks * task->index / job->threads; b < end; ++b) {
+            size_t offset = b * STREAM_CHUNK;
+            counts[b] = countKept(data + offset, length - offset < STREAM_CHUNK ? length - offset : STREAM_CHUNK);
+        }
+    }
+    return NULL;
+}
+
+/**********************************************************************************
+* Function:     openStreamAt
+* Input:        Stream *stream, Reader *reader - the stream to open and the reader
+*               under it, a file with its length and block counts (prefix sums),
+*               and the normalized offset to start at.
+* Output:       0 for success, -1 for error.
+* Operation:    Finds the block the offset falls in, normalizes it, and starts the
+*               stream at the offset within it.
+***********************************************************************************/
+static int openStreamAt(Stream *stream, Reader *reader, const unsigned char *data, size_t length,
+                        const size_t *counts, size_t blocks, size_t position) {
+
+    // The last block that starts at or before the position -- it surely keeps the position's byte.
+    size_t low = 0, high = blocks - 1;
+    while (low < high) {
+        size_t middle = (low + high + 1) / 2;
+        if (counts[middle] <= position)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    // Normalize that block, and skip what comes before the position.
+    openMemoryReader(reader, data + low * STREAM_CHUNK, length - low * STREAM_CHUNK);
+    stream->reader = reader;
+    stream->data = malloc(STREAM_CHUNK + STREAM_SLACK);
+    if (stream->data == NULL || fillStream(stream) != 1)
+        return -1;
+    stream->offset = position - counts[low];
+    return 0;
+
+}
+
+/**********************************************************************************
+* Function:     similarityTask
+* Input:        Task *task (as void *).
+* Output:       NULL.
+* Operation:    Compares the thread's share of the normalized streams -- which
+*               are known to be of the same length -- and raises job->different at
+*               a difference. Gives up once another thread found one.
+***********************************************************************************/
+static void *similarityTask(void *argument) {
+    Task *task = argument;
+    Parallel *job = task->job;
+    size_t total = job->srcCounts[job->srcBlocks];
+    size_t begin = total / job->threads * task->index;
+    size_t left = (task->index == job->threads - 1 ? total : total / job->threads * (task->index + 1)) - begin;
+    if (left == 0)
+        return NULL;
+
+    // Start a stream at the share in each file.
+    Reader srcReader, dstReader;
+    Stream src = {0}, dst = {0};
+    if (openStreamAt(&src, &srcReader, job->src, job->srcLength, job->srcCounts, job->srcBlocks, begin) == -1
+        || openStreamAt(&dst, &dstReader, job->dst, job->dstLength, job->dstCounts, job->dstBlocks, begin) == -1) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        goto release;
+    }
+
+    // Compare them, like findSimilarity(), up to the end of the share.
+    while (left > 0 && !__atomic_load_n(&job->different, __ATOMIC_RELAXED)) {
+        if ((src.offset == src.length && fillStream(&src) != 1)
+            || (dst.offset == dst.length && fillStream(&dst) != 1)) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        size_t count = src.length - src.offset < dst.length - dst.offset ? src.length - src.offset
+                                                                           : dst.length - dst.offset;
+        if (count > left)
+            count = left;
+        if (mismatch(src.data + src.offset, dst.data + dst.offset, count) < count) {
+            __atomic_store_n(&job->different, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        src.offset += count;
+        dst.offset += count;
+        left -= count;
+    }
+
+release:
+    free(src.data);
+    free(dst.data);
+    return NULL;
+}
+
+/**********************************************************************************
+* Function:     compareParallel
+* Input:        Reader *src, Reader *dst - two open readers over memory (buffers
+*               or mapped files).
+* Output:       1 for identical, 2 for different, 3 for similar, or READ_ERROR.
+* Operation:    The identity and similarity stages, split between threads. The
+*               verdict is the one of the sequential stages: identity holds if no
+*               share has a different byte and the lengths are equal, and
+*               similarity holds if both files keep as many bytes from the first
+*               different one on, and no share of the normalized streams differs.
+***********************************************************************************/
+static int compareParallel(Reader *src, Reader *dst) {
+
+    // The identity stage.
+    Parallel job = {.src = src->memory, .dst = dst->memory, .srcLength = src->memoryLength,
+                    .dstLength = dst->memoryLength, .threads = parallelThreads};
+    job.found = job.srcLength < job.dstLength ? job.srcLength : job.dstLength;
+    runTasks(&job, identityTask);
+    if (job.found == job.srcLength && job.found == job.dstLength)
+        return IDENTICAL;
+
+    // Count what every block keeps from the first different byte on.
+    job.src += job.found;
+    job.dst += job.found;
+    job.srcLength -= job.found;
+    job.dstLength -= job.found;
+    job.srcBlocks = (job.srcLength + STREAM_CHUNK - 1) / STREAM_CHUNK;
+    job.dstBlocks = (job.dstLength + STREAM_CHUNK - 1) / STREAM_CHUNK;
+    job.srcCounts = malloc((job.srcBlocks + 1) * sizeof(size_t));
+    job.dstCounts = malloc((job.dstBlocks + 1) * sizeof(size_t));
+    int status = READ_ERROR;
+    if (job.srcCounts == NULL || job.dstCounts == NULL)
+        goto release;
+    runTasks(&job, countTask);
+
+    // Turn the counts into prefix sums -- files that keep a different number of bytes are different.
+    size_t sums[2] = {0, 0};
+    for (int f = 0; f < 2; ++f) {
+        size_t *counts = f == 0 ? job.srcCounts : job.dstCounts;
+        size_t blocks = f == 0 ? job.srcBlocks : job.dstBlocks;
+        for (size_t b = 0; b < blocks; ++b) {
+            size_t count = counts[b];
+            counts[b] = sums[f];
+            sums[f] += count;
+        }
+        counts[blocks] = sums[f];
+    }
+    if (sums[0] != sums[1]) {
+        status = DIFFERENT;
+        goto release;
+    }
+
+    // The similarity stage.
+    runTasks(&job, similarityTask);
+    status = job.failed ? READ_ERROR : job.different ? DIFFERENT : SIMILAR;
+
+release:
+    free(job.srcCounts);
+    free(job.dstCounts);
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     compareReaders
+* Input:        Reader *src, Reader *dst - two open readers.
+* Output:       1 for identical, 2 for different, 3 for similar, or READ_ERROR.
+* Operation:    Runs the identity stage, and if a difference is found, runs the
+*               similarity stage from that point. The common prefix is equal under
+*               any normalization, so only the rest of the files matters. Two
+*               names of the same regular file at the same offset are identical
+*               without reading anything, and big files in memory are compared by several threads
+*               (see compareParallel()).
+***********************************************************************************/
+static int compareReaders(Reader *src, Reader *dst) {
+
+    // Short-circuit on the same regular file opened twice.
+    if (S_ISREG(src->info.st_mode) && S_ISREG(dst->info.st_mode) && src->info.st_dev == dst->info.st_dev
+        && src->info.st_ino == dst->info.st_ino && src->start == dst->start)
+        return IDENTICAL;
+
+    // Split big files in memory between threads.
+    if (parallelThreads > 1 && src->memory != NULL && dst->memory != NULL && src->memoryLength >= PARALLEL_MIN
+        && dst->memoryLength >= PARALLEL_MIN)
+        return compareParallel(src, dst);
+
+    int status = findIdentity(src, dst);
+    if (status != 0)
+        return status;
+    return findSimilarity(src, dst);
+}
+
+
+// Guards selectKernels(), so the kernels are picked once by whichever call comes first.
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+/**********************************************************************************
+* Function:     setNormalization
+* Input:        const char *rules - a comma separated list of rules.
+* Output:       0 for success, -1 for an unknown or empty rule.
+* Operation:    Sets what similarity ignores -- space, newline, tab, return
+*               (every \r, so \r\n line-breaks match \n ones, but a lone \r is
+*               ignored too) and blank (all of ' ', \t, \n, \v, \f and \r) -- and
+*               whether it folds ASCII case (case). Every rule holds for a byte
+*               wherever it is, so there is no rule for trailing whitespace alone
+*               (whether whitespace trails depends on what follows it), and
+*               "trailing" is rejected like any unknown rule. An empty list makes
+*               similarity the same as identity, but an empty rule in a list
+*               ("space,,case" or "space,") is rejected. The default is
+*               NORMALIZATION_DEFAULT. Takes effect only before the first
+*               comparison or loaded reference, as the tables are built once.
+***********************************************************************************/
+int setNormalization(const char *rules) {
+    static const struct {
+        const char *name;
+        unsigned rule;
+    } names[] = {{"space", RULE_SPACE}, {"newline", RULE_NEWLINE}, {"tab", RULE_TAB}, {"return", RULE_RETURN},
+                 {"blank", RULE_BLANK}, {"case", RULE_CASE}};
+    unsigned parsed = 0;
+    int more = *rules != '\0';
+    while (more) {
+        size_t length = strcspn(rules, ",");
+        size_t i = 0;
+        while (i < sizeof(names) / sizeof(names[0])
+               && (strlen(names[i].name) != length || strncmp(names[i].name, rules, length)))
+            ++i;
+        if (i == sizeof(names) / sizeof(names[0]))
+            return -1;
+        parsed |= names[i].rule;
+        more = rules[length] == ',';
+        rules += length + more;
+    }
+    normalizationRules = parsed;
+    return 0;
+}
+
+/**********************************************************************************
+* Function:     compareFDs
+* Input:        int srcFD, int dstFD -- two open File Descriptors.
+* Output:       1 for identical, 2 for different, 3 for similar, or READ_ERROR.
+* Operation:    Compares the rest of two files from their current offsets. The
+*               File Descriptors stay open and belong to the caller.
+***********************************************************************************/
+int compareFDs(int srcFD, int dstFD) {
+    pthread_once(&kernelsOnce, selectKernels);
+    Reader src = {0}, dst = {0};
+    int status = READ_ERROR;
+    if (openReader(&src, srcFD) == 0 && openReader(&dst, dstFD) == 0)
+        status = compareReaders(&src, &dst);
+    closeReader(&src);
+    closeReader(&dst);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     compareBuffers
+* Input:        Two buffers and their lengths.
+* Output:       1 for identical, 2 for different, 3 for similar, or READ_ERROR.
+* Operation:    Compares two buffers that are already in memory.
+***********************************************************************************/
+int compareBuffers(const void *src, size_t srcLength, const void *dst, size_t dstLength) {
+    pthread_once(&kernelsOnce, selectKernels);
+    Reader srcReader, dstReader;
+    openMemoryReader(&srcReader, src, srcLength);
+    openMemoryReader(&dstReader, dst, dstLength);
+    return compareReaders(&srcReader, &dstReader);
+}
+
+/**********************************************************************************
+* Function:     normalizeReference
+* Input:        Reference *reference - a reference whose data is loaded.
+* Output:       0 for success, -1 for error.
+* Operation:    Keeps the normalized form of the reference next to its data, for
+*               the streaming comparisons. Releases the reference on error.
+***********************************************************************************/
+static int normalizeReference(Reference *reference) {
+    pthread_once(&kernelsOnce, selectKernels);
+    reference->normalized = malloc(reference->length + STREAM_SLACK);
+    if (reference->normalized == NULL) {
+        releaseReference(reference);
+        return -1;
+    }
+    reference->normalizedLength = normalize(reference->data, reference->length, reference->normalized);
+    return 0;
+}
+
+/**********************************************************************************
+* Function:     loadReference
+* Input:        Reference *reference - the reference to load, int fd - File Descriptor.
+* Output:       0 for success, -1 for error.
+* Operation:    Loads the rest of a file from its current offset once, so it can
+*               be compared against any number of files. The rest of a regular
+*               file is mapped, anything else is read into a growing buffer. The
+*               normalized form is kept as well. The File Descriptor can be
+*               closed afterwards.
+***********************************************************************************/
+int loadReference(Reference *reference, int fd) {
+
+    memset(reference, 0, sizeof(*reference));
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1) {
+        return -1;
+    }
+
+    // Map the rest of regular files. If mapping fails for some reason, fall back to reading.
+    off_t start = S_ISREG(fileStat.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    if (start != -1 && fileStat.st_size > start) {
+        const unsigned char *rest = mapRest(fd, fileStat.st_size, start, &reference->map);
+        if (rest != NULL) {
+            reference->data = rest;
+            reference->length = fileStat.st_size - start;
+            return normalizeReference(reference);
+        }
+    }
+
+    // Read the file, doubling the buffer whenever it fills up.
+    size_t capacity = 0;
+    for (;;) {
+        if (reference->length == capacity) {
+            capacity = capacity ? capacity * 2 : BLOCK_SIZE;
+            unsigned char *buffer = realloc(reference->buffer, capacity);
+            if (buffer == NULL) {
+                releaseReference(reference);
+                return -1;
+            }
+            reference->buffer = buffer;
+        }
+        ssize_t received = read(fd, reference->buffer + reference->length, capacity - reference->length);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received == -1) {
+            releaseReference(reference);
+            return -1;
+        }
+        if (received == 0)
+            break;
+        reference->length += received;
+    }
+    reference->data = reference->buffer;
+    return normalizeReference(reference);
+
+}
+
+/**********************************************************************************
+* Function:     compareToReference
+* Input:        int fd - an open File Descriptor, a loaded reference.
+* Output:       1 for identical, 2 for different, 3 for similar, or READ_ERROR.
+* Operation:    Compares the rest of a file against a reference. The file is fed
+*               to a streaming comparison block by block (see feedComparison()),
+*               so only the file is normalized -- the reference was normalized
+*               when it was loaded -- and reading stops once the file is surely
+*               different. Big files in memory are compared by several threads
+*               instead (see compareParallel()). The reference is only read, so
+*               one reference can serve several threads at once.
+***********************************************************************************/
+int compareToReference(int fd, const Reference *reference) {
+    pthread_once(&kernelsOnce, selectKernels);
+    Reader src, dst;
+    Comparison comparison;
+    int status = READ_ERROR;
+    if (openReader(&src, fd) == 0) {
+        if (parallelThreads > 1 && src.memory != NULL && src.memoryLength >= PARALLEL_MIN
+            && reference->length >= PARALLEL_MIN) {
+            openMemoryReader(&dst, reference->data, reference->length);
+            status = compareReaders(&src, &dst);
+        } else if (beginComparison(&comparison, reference) == 0) {
+            int filled;
+            while ((filled = fillReader(&src)) == 1 && feedComparison(&comparison, src.block, src.length) == 0)
+                ;
+            status = endComparison(&comparison);
+            status = filled == -1 ? READ_ERROR : status;
+        }
+    }
+    closeReader(&src);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     releaseReference
+* Input:        Reference *reference - a loaded reference.
+* Output:       None.
+* Operation:    Releases the mapping or the buffer of the reference.
+***********************************************************************************/
+void releaseReference(Reference *reference) {
+    if (reference->map != NULL) {
+        unmapRest(reference->map, reference->data, reference->length);
+    }
+    free(reference->buffer);
+    free(reference->normalized);
+    memset(reference, 0, sizeof(*reference));
+}
+
+/**********************************************************************************
+* Function:     beginComparison
+* Input:        Comparison *comparison - the comparison to start, a loaded reference.
+* Output:       0 for success, -1 for error.
+* Operation:    Starts comparing a stream of bytes that arrives in pieces (see
+*               feedComparison()) against a reference.
+***********************************************************************************/
+int beginComparison(Comparison *comparison, const Reference *reference) {
+    comparison->reference = reference;
+    comparison->offset = 0;
+    comparison->normalizedOffset = 0;
+    comparison->identical = 1;
+    comparison->different = 0;
+    comparison->buffer = malloc(STREAM_CHUNK + STREAM_SLACK);
+    return comparison->buffer != NULL ? 0 : -1;
+}
+
+/**********************************************************************************
+* Function:     feedComparison
+* Input:        Comparison *comparison - a started comparison, the next bytes of
+*               the stream and their length.
+* Output:       DIFFERENT once the stream can't be identical nor similar anymore,
+*               0 while it still can.
+* Operation:    The stream stays identical while it is a prefix of the reference,
+*               and similar while its normalized form is a prefix of the
+*               normalized reference. Once it is neither, no more bytes can
+*               change the verdict, so the caller can stop producing them. A
+*               prefix of the reference is a prefix of it under any
+*               normalization too, so the stream is only normalized from the
+*               piece it stopped being a prefix in, and the normalized offset is
+*               found by counting what the prefix keeps.
+***********************************************************************************/
+int feedComparison(Comparison *comparison, const void *data, size_t length) {
+
+    const Reference *reference = comparison->reference;
+    const unsigned char *bytes = data;
+    if (comparison->different)
+        return DIFFERENT;
+
+    // Identity -- the stream so far must be a prefix of the reference.
+    if (comparison->identical) {
+        size_t left = reference->length - comparison->offset;
+        if (length <= left && mismatch(reference->data + comparison->offset, bytes, length) == length) {
+            comparison->offset += length;
+            return 0;
+        }
+        comparison->identical = 0;
+        comparison->normalizedOffset = countKept(reference->data, comparison->offset);
+    }
+
+    // Similarity -- the normalized stream so far must be a prefix of the normalized reference.
+    for (size_t done = 0; done < length;) {
+        size_t count = length - done < STREAM_CHUNK ? length - done : STREAM_CHUNK;
+        size_t kept = normalize(bytes + done, count, comparison->buffer);
+        size_t left = reference->normalizedLength - comparison->normalizedOffset;
+        if (kept > left || mismatch(reference->normalized + comparison->normalizedOffset, comparison->buffer,
+                                    kept) < kept) {
+            comparison->different = 1;
+            return DIFFERENT;
+        }
+        comparison->normalizedOffset += kept;
+        done += count;
+    }
+    return 0;
+
+}
+
+/**********************************************************************************
+* Function:     endComparison
+* Input:        Comparison *comparison - a started comparison.
+* Output:       1 for identical, 2 for different, 3 for similar.
+* Operation:    Decides the verdict once the stream is over, and releases the
+*               comparison. A stream that is a shorter prefix of the reference is
+*               similar if the rest of the reference is all ignored.
+***********************************************************************************/
+int endComparison(Comparison *comparison) {
+    const Reference *reference = comparison->reference;
+    int status = DIFFERENT;
+    if (comparison->identical && comparison->offset < reference->length)
+        comparison->normalizedOffset = countKept(reference->data, comparison->offset);
+    if (comparison->identical && comparison->offset == reference->length)
+        status = IDENTICAL;
+    else if (!comparison->different && comparison->normalizedOffset == reference->normalizedLength)
+        status = SIMILAR;
+    free(comparison->buffer);
+    comparison->buffer = NULL;
+    return status;
+}
@@ -0,0 +1,71 @@
+// Shlomi Ben-Shushan
+
+#ifndef COMPARATOR_H
+#define COMPARATOR_H
+
+#include <stddef.h>
+
+// Define possible results according to exercise instructions.
+#define IDENTICAL 1
+#define SIMILAR   3
+#define DIFFERENT 2
+
+// Define an error result for a failed read.
+#define READ_ERROR  -2
+
+// Define the rules of similarity that hold unless setNormalization() says otherwise.
+#define NORMALIZATION_DEFAULT "space,newline,case"
+
+/**********************************************************************************
+* Struct:       Reference
+* Operation:    A file loaded once by loadReference(), to compare many files
+*               against. data[0..length) is either a mapping or a heap buffer, and
+*               normalized[0..normalizedLength) is its normalized form (by
+*               default spaces and line-breaks removed, letters upper-cased).
+***********************************************************************************/
+typedef struct {
+    const unsigned char *data;
+    size_t length;
+    void *map;
+    unsigned char *buffer;
+    unsigned char *normalized;
+    size_t normalizedLength;
+} Reference;
+
+/**********************************************************************************
+* Struct:       Comparison
+* Operation:    A comparison of a stream that arrives in pieces against a
+*               reference -- how much of the reference and of its normalized form
+*               the stream matched so far, and whether it still can be identical
+*               or is already known to be different.
+***********************************************************************************/
+typedef struct {
+    const Reference *reference;
+    size_t offset;
+    size_t normalizedOffset;
+    int identical;
+    int different;
+    unsigned char *buffer;
+} Comparison;
+
+// Compare two files, two buffers, or a file against a loaded reference. Each returns IDENTICAL,
+// SIMILAR, DIFFERENT or READ_ERROR.
+int compareFDs(int srcFD, int dstFD);
+int compareBuffers(const void *src, size_t srcLength, const void *dst, size_t dstLength);
+int compareToReference(int fd, const Reference *reference);
+
+// Set the rules of similarity, a comma separated list of space, newline, tab, return, blank and case (0
+// for success, -1 for an unknown or empty rule). It must be called before anything is compared or loaded.
+int setNormalization(const char *rules);
+
+// Load a reference from an open File Descriptor (0 for success, -1 for error), and release it.
+int loadReference(Reference *reference, int fd);
+void releaseReference(Reference *reference);
+
+// Compare a stream against a loaded reference piece by piece. feedComparison() returns DIFFERENT as
+// soon as the verdict is settled, and endComparison() returns the verdict and releases the comparison.
+int beginComparison(Comparison *comparison, const Reference *reference);
+int feedComparison(Comparison *comparison, const void *data, size_t length);
+int endComparison(Comparison *comparison);
+
+#endif
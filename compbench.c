@@ -0,0 +1,441 @@
+// Shlomi Ben-Shushan
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "comparator.h"
+
+// Defines status codes.
+#define SUCCESS     0
+#define ERROR       -1
+
+// Defines the defaults -- the sizes of the file pairs, the percents of whitespace, the cases (identical,
+// similar, or the percent of the file where the first significant mismatch is), the engines, and how
+// many times every measurement is taken (the fastest is reported).
+#define DEFAULT_SIZES       "1K,16K,256K,4M,64M"
+#define DEFAULT_WHITESPACE  "0,10,50"
+#define DEFAULT_CASES       "identical,similar,50,100"
+#define DEFAULT_ENGINES     "buffers,files,bytewise"
+#define DEFAULT_RUNS        5
+
+// Defines the bytes a single measurement compares at least -- small pairs are compared many times over,
+// so the clock and the counters are read rarely enough not to matter.
+#define MIN_BYTES   (1 << 22)
+
+// Defines the files the files engine compares, in the working directory.
+#define SRC_FILE    "./compbench.src"
+#define DST_FILE    "./compbench.dst"
+
+// Defines the hardware counters, and the command line synopsis.
+#define COUNTERS    4
+#define USAGE       "Usage: compbench [-s SIZES] [-w PERCENTS] [-c CASES] [-e ENGINES] [-r RUNS]\n"
+
+/**********************************************************************************
+* Struct:       Counter
+* Operation:    A hardware counter of perf_event_open() -- its name in the
+*               report, its type and configuration, and its File Descriptor (-1
+*               when the counter is unavailable).
+***********************************************************************************/
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+} Counter;
+
+// The counters -- cycles, instructions, branch misses, and read misses of the last level cache.
+Counter counters[COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, ERROR},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, ERROR},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, ERROR},
+    {"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                       | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), ERROR}
+};
+
+/**********************************************************************************
+* Function:     print
+* Input:        String.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the given string to the standard output.
+***********************************************************************************/
+int print(const char *msg) {
+    if (write(1, msg, strlen(msg)) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     openCounters
+* Input:        None.
+* Output:       None.
+* Operation:    Opens every counter for this thread, counting the kernel as well
+*               (the files engine spends time there) or, if perf_event_paranoid
+*               doesn't allow it, user space alone. A counter that can't be opened
+*               at all (no PMU, a VM, or no permission) is left out of the report.
+***********************************************************************************/
+void openCounters(void) {
+    for (int i = 0; i < COUNTERS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters[i].fd == ERROR) {
+            attr.exclude_kernel = 1;
+            counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+}
+
+/**********************************************************************************
+* Function:     parseSize
+* Input:        A size with an optional K, M or G suffix.
+* Output:       The size in bytes.
+* Operation:    Parses sizes as 64K or 4G.
+***********************************************************************************/
+size_t parseSize(const char *text) {
+    char *end;
+    size_t size = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': return size << 10;
+        case 'M': case 'm': return size << 20;
+        case 'G': case 'g': return size << 30;
+        default:            return size;
+    }
+}
+
+/**********************************************************************************
+* Function:     generatePair
+* Input:        Two buffers of the given size, a percent of whitespace, and the
+*               case -- "identical", "similar", or the percent of the buffer
+*               where the first significant mismatch is.
+* Output:       The verdict the comparator should give the pair.
+* Operation:    Fills src with pseudo-random letters and digits, with spaces and
+*               line-breaks at the given density, and makes dst of it: the same
+*               bytes, the same bytes with letters upper-cased and spaces and
+*               line-breaks swapped (similar all the way), or the same bytes with
+*               one letter replaced at the mismatch position.
+***********************************************************************************/
+int generatePair(unsigned char *src, unsigned char *dst, size_t size, int whitespace, const char *testCase) {
+
+    // Fill src -- the generator is a fixed xorshift, so runs are comparable.
+    const char *letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < size; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if ((int)(state % 100) < whitespace) {
+            src[i] = state & 0x100 ? '\n' : ' ';
+        } else {
+            src[i] = letters[(state >> 8) % 62];
+        }
+    }
+
+    // Make dst of it.
+    memcpy(dst, src, size);
+    if (!strcmp(testCase, "identical") || size == 0) {
+        return IDENTICAL;
+    }
+    if (!strcmp(testCase, "similar")) {
+        for (size_t i = 0; i < size; ++i) {
+            if ('a' <= dst[i] && dst[i] <= 'z') {
+                dst[i] -= 32;
+            } else if (dst[i] == ' ' || dst[i] == '\n') {
+                dst[i] = dst[i] == ' ' ? '\n' : ' ';
+            }
+        }
+        return SIMILAR;
+    }
+    size_t position = size / 100 * strtol(testCase, NULL, 10);
+    if (position >= size) {
+        position = size - 1;
+    }
+    dst[position] = src[position] == 'x' || src[position] == 'X' ? 'y' : 'x';
+    return DIFFERENT;
+
+}
+
+/**********************************************************************************
+* Function:     writePair
+* Input:        The two buffers and their size.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the buffers to SRC_FILE and DST_FILE, for the files engine.
+***********************************************************************************/
+int writePair(const unsigned char *src, const unsigned char *dst, size_t size) {
+    const char *paths[] = {SRC_FILE, DST_FILE};
+    const unsigned char *buffers[] = {src, dst};
+    for (int f = 0; f < 2; ++f) {
+        int fd = open(paths[f], O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == ERROR) {
+            print("Error in: open\n");
+            return ERROR;
+        }
+        for (size_t done = 0; done < size;) {
+            ssize_t written = write(fd, buffers[f] + done, size - done);
+            if (written <= 0) {
+                print("Error in: write\n");
+                close(fd);
+                return ERROR;
+            }
+            done += written;
+        }
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     compareBytewise
+* Input:        Two buffers and their lengths.
+* Output:       1 for identical, 2 for different, 3 for similar.
+* Operation:    The comparison of the original ex31, a byte at a time -- the
+*               identity loop, and then selectiveReadByte() and areSimilar() --
+*               over memory instead of a read() per byte. It is the per-byte
+*               baseline the kernels of comparator.c are measured against.
+***********************************************************************************/
+int compareBytewise(const unsigned char *src, size_t srcLength, const unsigned char *dst, size_t dstLength) {
+
+    // Identity loop.
+    size_t i = 0, j = 0;
+    while (i < srcLength && j < dstLength && src[i] == dst[j]) {
+        ++i;
+        ++j;
+    }
+    if (i == srcLength && j == dstLength) {
+        return IDENTICAL;
+    }
+
+    // Similarity loop -- skip spaces and line-breaks, and compare letters regardless of case.
+    for (;;) {
+        while (i < srcLength && (src[i] == ' ' || src[i] == '\n')) {
+            ++i;
+        }
+        while (j < dstLength && (dst[j] == ' ' || dst[j] == '\n')) {
+            ++j;
+        }
+        if (i == srcLength || j == dstLength) {
+            return i == srcLength && j == dstLength ? SIMILAR : DIFFERENT;
+        }
+        unsigned char a = src[i++], b = dst[j++];
+        if (a != b && !('A' <= a && a <= 'Z' && b == a + 32) && !('a' <= a && a <= 'z' && b == a - 32)) {
+            return DIFFERENT;
+        }
+    }
+
+}
+
+/**********************************************************************************
+* Function:     compareOnce
+* Input:        The engine, and the pair in memory with its size.
+* Output:       The verdict, or READ_ERROR.
+* Operation:    Compares the pair once -- with compareBuffers(), with compareFDs()
+*               on SRC_FILE and DST_FILE, or with compareBytewise().
+***********************************************************************************/
+int compareOnce(const char *engine, const unsigned char *src, const unsigned char *dst, size_t size) {
+    if (!strcmp(engine, "buffers")) {
+        return compareBuffers(src, size, dst, size);
+    }
+    if (!strcmp(engine, "bytewise")) {
+        return compareBytewise(src, size, dst, size);
+    }
+    int srcFD = open(SRC_FILE, O_RDONLY), dstFD = open(DST_FILE, O_RDONLY);
+    int verdict = srcFD != ERROR && dstFD != ERROR ? compareFDs(srcFD, dstFD) : READ_ERROR;
+    if (srcFD != ERROR) {
+        close(srcFD);
+    }
+    if (dstFD != ERROR) {
+        close(dstFD);
+    }
+    return verdict;
+}
+
+/**********************************************************************************
+* Function:     measure
+* Input:        The engine, the pair with its size, its whitespace percent and
+*               case, the verdict it should get, and the number of runs.
+* Output:       0 for success, -1 for error.
+* Operation:    Takes runs measurements of the pair -- each compares it enough
+*               times to cover MIN_BYTES -- and prints the fastest as a JSON line:
+*               nanoseconds per comparison, GB/s, and per byte the cycles,
+*               instructions, branch misses and LLC misses (null for a counter
+*               that is unavailable).
+***********************************************************************************/
+int measure(const char *engine, const unsigned char *src, const unsigned char *dst, size_t size, int whitespace,
+            const char *testCase, int expected, int runs) {
+
+    size_t repeats = size >= MIN_BYTES ? 1 : MIN_BYTES / (size ? size : 1);
+    double best = 0;
+    uint64_t bestCounts[COUNTERS] = {0};
+    int verdict = 0;
+    for (int run = 0; run < runs; ++run) {
+
+        // Compare the pair repeats times, between reads of the clock and the counters.
+        for (int i = 0; i < COUNTERS; ++i) {
+            if (counters[i].fd != ERROR) {
+                ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t r = 0; r < repeats; ++r) {
+            verdict = compareOnce(engine, src, dst, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t counts[COUNTERS] = {0};
+        for (int i = 0; i < COUNTERS; ++i) {
+            if (counters[i].fd != ERROR) {
+                ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(counters[i].fd, &counts[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                    counts[i] = 0;
+                }
+            }
+        }
+
+        // Keep the fastest run.
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (run == 0 || seconds < best) {
+            best = seconds;
+            memcpy(bestCounts, counts, sizeof(counts));
+        }
+
+    }
+    if (verdict != expected) {
+        char report[128];
+        snprintf(report, sizeof(report), "%s gave %d instead of %d for %zu bytes, %d%% whitespace, %s\n", engine,
+                 verdict, expected, size, whitespace, testCase);
+        print(report);
+        return ERROR;
+    }
+
+    // Report it.
+    double bytes = (double)size * repeats;
+    const char *kernel = getenv("COMP_KERNEL") != NULL ? getenv("COMP_KERNEL") : "auto";
+    if (!strcmp(engine, "bytewise")) {
+        kernel = "none";
+    }
+    printf("{\"engine\":\"%s\",\"kernel\":\"%s\",\"size\":%zu,\"whitespace\":%d,\"case\":\"%s\",\"verdict\":%d,"
+           "\"ns\":%.1f,\"gbps\":%.3f", engine, kernel, size, whitespace, testCase, verdict, best * 1e9 / repeats,
+           best > 0 ? bytes / best / 1e9 : 0);
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (counters[i].fd != ERROR) {
+            printf(",\"%s_per_byte\":%.4f", counters[i].name, bestCounts[i] / bytes);
+        } else {
+            printf(",\"%s_per_byte\":null", counters[i].name);
+        }
+    }
+    printf("}\n");
+    fflush(stdout);
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     main
+* Input:        argc, argv -- standard input:
+*               [-s SIZES] [-w PERCENTS] [-c CASES] [-e ENGINES] [-r RUNS].
+* Output:       0 if finished properly, or exit with code -1 if a problem occured.
+* Operation:    Microbenchmark of the comparator. Every option is a comma
+*               separated list: -s sizes (1K,16K,256K,4M,64M, with K, M or G),
+*               -w percents of whitespace (0,10,50), -c cases (identical,similar,
+*               50,100 -- a number is where the mismatch is, in percents of the
+*               size), and -e engines (buffers for compareBuffers(), files for
+*               compareFDs(), and bytewise for the per-byte loop of the original
+*               ex31). -r sets the runs of every measurement (5). Every
+*               combination is printed as a JSON line (see measure()). The
+*               kernels are picked as usual, and COMP_KERNEL forces them.
+***********************************************************************************/
+int main(int argc, char **argv) {
+
+    // Parse options.
+    char *sizes = DEFAULT_SIZES, *densities = DEFAULT_WHITESPACE, *cases = DEFAULT_CASES;
+    char *engines = DEFAULT_ENGINES;
+    int runs = DEFAULT_RUNS, option;
+    while ((option = getopt(argc, argv, "s:w:c:e:r:")) != -1) {
+        if (option == 's') {
+            sizes = optarg;
+        } else if (option == 'w') {
+            densities = optarg;
+        } else if (option == 'c') {
+            cases = optarg;
+        } else if (option == 'e') {
+            engines = optarg;
+        } else if (option == 'r') {
+            runs = strtol(optarg, NULL, 10);
+        } else {
+            print(USAGE);
+            exit(ERROR);
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+    openCounters();
+
+    // Measure every combination -- the lists are copied, as strtok_r() cuts them.
+    int status = SUCCESS;
+    char *sizeList = strdup(sizes), *sizeState;
+    for (char *sizeText = strtok_r(sizeList, ",", &sizeState); sizeText != NULL && status == SUCCESS;
+         sizeText = strtok_r(NULL, ",", &sizeState)) {
+        size_t size = parseSize(sizeText);
+        unsigned char *src = malloc(size ? size : 1), *dst = malloc(size ? size : 1);
+        if (src == NULL || dst == NULL) {
+            print("Error in: malloc\n");
+            free(src);
+            status = ERROR;
+            break;
+        }
+        char *densityList = strdup(densities), *densityState;
+        for (char *density = strtok_r(densityList, ",", &densityState); density != NULL && status == SUCCESS;
+             density = strtok_r(NULL, ",", &densityState)) {
+            char *caseList = strdup(cases), *caseState;
+            for (char *testCase = strtok_r(caseList, ",", &caseState); testCase != NULL && status == SUCCESS;
+                 testCase = strtok_r(NULL, ",", &caseState)) {
+                int whitespace = strtol(density, NULL, 10);
+                int expected = generatePair(src, dst, size, whitespace, testCase);
+                int written = 0;
+                char *engineList = strdup(engines), *engineState;
+                for (char *engine = strtok_r(engineList, ",", &engineState); engine != NULL && status == SUCCESS;
+                     engine = strtok_r(NULL, ",", &engineState)) {
+                    int known = !strcmp(engine, "buffers") || !strcmp(engine, "files")
+                                || !strcmp(engine, "bytewise");
+                    if (!strcmp(engine, "files") && !written++ && writePair(src, dst, size) == ERROR) {
+                        status = ERROR;
+                    } else if (!known) {
+                        print(USAGE);
+                        status = ERROR;
+                    } else {
+                        status = measure(engine, src, dst, size, whitespace, testCase, expected, runs);
+                    }
+                }
+                free(engineList);
+            }
+            free(caseList);
+        }
+        free(densityList);
+        free(src);
+        free(dst);
+    }
+    free(sizeList);
+    unlink(SRC_FILE);
+    unlink(DST_FILE);
+    if (status != SUCCESS) {
+        exit(ERROR);
+    }
+    return SUCCESS;
+
+}
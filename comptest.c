@@ -0,0 +1,597 @@
+// Shlomi Ben-Shushan
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "comparator.h"
+
+// Defines status codes.
+#define SUCCESS     0
+#define ERROR       -1
+
+// Defines the defaults -- the kernels to check, how many random pairs each of them checks under each set
+// of rules, and the seed of the pairs.
+#define DEFAULT_KERNELS "scalar,sse2,sse4.2,avx2"
+#define DEFAULT_PAIRS   500
+#define DEFAULT_SEED    1
+
+// Defines the longest random pair -- a few pairs are long enough to span several blocks of a reader and
+// many chunks of a stream -- and how many mismatches of a kernel are printed.
+#define MAX_LENGTH  (3 << 20)
+#define REPORTED    5
+
+// Defines the prefix the files are compared past -- longer than a page, and not a multiple of it.
+#define PREFIX_LENGTH   5000
+
+// Defines the command line synopsis.
+#define USAGE   "Usage: comptest [-k KERNELS] [-r RULES] [-n PAIRS] [-s SEED]\n"
+
+/**********************************************************************************
+* Struct:       EdgeCase
+* Operation:    A pair of files written out by hand, and the verdict it must get
+*               under the given rules of similarity (NULL for the default ones).
+***********************************************************************************/
+typedef struct {
+    const char *rules;
+    const char *name;
+    const char *src;
+    size_t srcLength;
+    const char *dst;
+    size_t dstLength;
+    int expected;
+} EdgeCase;
+
+// Defines an edge case of two string literals (which may hold '\0' and '\xff'), under the default rules
+// or under others.
+#define EDGE(name, src, dst, expected) RULE_EDGE(NULL, name, src, dst, expected)
+#define RULE_EDGE(rules, name, src, dst, expected) {rules, name, src, sizeof(src) - 1, dst, sizeof(dst) - 1, \
+                                                    expected}
+
+// The edge cases, mostly around where the original ex31 left its identity loop -- at the first mismatch,
+// or at the end of one of the files. The original got a few of them wrong: it kept comparing the last
+// byte of a file that ended ("ab" against "abb" was IDENTICAL, and against "abB" SIMILAR), and it took a
+// 0xff byte for the end of the file.
+const EdgeCase edgeCases[] = {
+    EDGE("both empty", "", "", IDENTICAL),
+    EDGE("empty against whitespace", "", " \n ", SIMILAR),
+    EDGE("whitespace against empty", "\n\n", "", SIMILAR),
+    EDGE("empty against a letter", "", "a", DIFFERENT),
+    EDGE("identical", "ab c\n", "ab c\n", IDENTICAL),
+    EDGE("src ends, dst has whitespace left", "ab", "ab \n", SIMILAR),
+    EDGE("dst ends, src has whitespace left", "ab\n\n", "ab", SIMILAR),
+    EDGE("src ends, dst repeats its last byte", "ab", "abb", DIFFERENT),
+    EDGE("src ends, dst repeats its last byte in upper-case", "ab", "abB", DIFFERENT),
+    EDGE("dst ends, src repeats its last byte", "abb", "ab", DIFFERENT),
+    EDGE("src ends, dst has a letter after whitespace", "ab", "ab c", DIFFERENT),
+    EDGE("mismatch at the first byte, whitespace", " ab", "ab", SIMILAR),
+    EDGE("mismatch at the first byte, case", "Ab", "ab", SIMILAR),
+    EDGE("mismatch at the first byte, letter", "xb", "ab", DIFFERENT),
+    EDGE("whitespace in both at the mismatch", "a \nb", "a\n b", SIMILAR),
+    EDGE("whitespace and case at the mismatch", "a B", "ab", SIMILAR),
+    EDGE("letter after whitespace at the mismatch", "a b", "a c", DIFFERENT),
+    EDGE("case in the last byte", "abc", "abC", SIMILAR),
+    EDGE("0xff byte at the end", "a\xff", "a", DIFFERENT),
+    EDGE("0xff byte against whitespace", "a\xff", "a ", DIFFERENT),
+    EDGE("NUL bytes", "a\0b", "a\0 B", SIMILAR),
+    EDGE("NUL against end", "a\0", "a", DIFFERENT),
+    EDGE("symbols that differ in bit 0x20", "@", "`", DIFFERENT),
+    EDGE("brackets that differ in bit 0x20", "[", "{", DIFFERENT),
+    EDGE("Latin-1 letters are not folded", "\xe0", "\xc0", DIFFERENT),
+    EDGE("tabs are not ignored", "a\tb", "ab", DIFFERENT),
+    EDGE("carriage returns are not ignored", "a\r\nb", "a\nb", DIFFERENT),
+    EDGE("trailing line-break", "abc\n", "abc", SIMILAR),
+    EDGE("shorter identical prefix", "abc", "ab", DIFFERENT),
+    RULE_EDGE("", "no rules, whitespace", "a b", "ab", DIFFERENT),
+    RULE_EDGE("", "no rules, case", "A", "a", DIFFERENT),
+    RULE_EDGE("", "no rules, identical", "a b", "a b", IDENTICAL),
+    RULE_EDGE("case", "case alone, case", "Ab", "aB", SIMILAR),
+    RULE_EDGE("case", "case alone, whitespace", "a\nb", "ab", DIFFERENT),
+    RULE_EDGE("tab", "tab, tab", "a\t\tb", "ab", SIMILAR),
+    RULE_EDGE("tab", "tab, space", "a b", "ab", DIFFERENT),
+    RULE_EDGE("tab", "tab, case", "a", "A", DIFFERENT),
+    RULE_EDGE("return", "return, CRLF line-breaks", "a\r\nb\r\n", "a\nb\n", SIMILAR),
+    RULE_EDGE("return", "return, a lone carriage return", "a\rb", "ab", SIMILAR),
+    RULE_EDGE("return", "return, line-break", "a\nb", "ab", DIFFERENT),
+    RULE_EDGE("space,newline,return", "return with newline", "a\r\n b", "ab", SIMILAR),
+    RULE_EDGE("blank,case", "blank, all of them", "a \t\n\v\f\rB", "Ab", SIMILAR),
+    RULE_EDGE("blank,case", "blank, not NUL", "a\0b", "ab", DIFFERENT),
+    RULE_EDGE("blank,case", "blank, trailing", "ab \t\n", "AB", SIMILAR)
+};
+
+/**********************************************************************************
+* Struct:       ParserCase
+* Operation:    A list of rules, and whether setNormalization() must accept it.
+***********************************************************************************/
+typedef struct {
+    const char *rules;
+    int valid;
+} ParserCase;
+
+// The lists of rules setNormalization() is checked with -- an empty list is no rules, but an empty rule,
+// an unknown one (in any case) and trailing whitespace alone (which no rule of a byte describes) are
+// rejected.
+const ParserCase parserCases[] = {
+    {"", 1}, {"space", 1}, {"space,newline,case", 1}, {"case,newline,space", 1}, {"space,space", 1},
+    {"tab,return,blank,case", 1}, {",", 0}, {"space,", 0}, {",space", 0}, {"space,,case", 0},
+    {"bogus", 0}, {"Space", 0}, {"spac", 0}, {"spaces", 0}, {"space newline", 0}, {"cr", 0},
+    {"trailing", 0}, {"space,trailing", 0}
+};
+
+// The sets of rules every kernel is checked under, unless -r names one.
+const char *ruleSets[] = {NORMALIZATION_DEFAULT, "", "case", "tab", "return", "space,newline,return",
+                          "blank,case", "space,tab,return,case"};
+
+// What the model ignores, and whether it folds case, under the rules checked now (see setModel()).
+unsigned char modelIgnores[256];
+int modelFolds;
+
+// The mismatches found by this process (a process checks one kernel).
+int mismatches = 0;
+
+/**********************************************************************************
+* Function:     print
+* Input:        String.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the given string to the standard output.
+***********************************************************************************/
+int print(const char *msg) {
+    if (write(1, msg, strlen(msg)) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     setModel
+* Input:        A valid list of rules.
+* Output:       None.
+* Operation:    Sets what the model ignores and whether it folds case, by the
+*               rules as documented rather than by the tables of comparator.c.
+*               The default rules are those of the original ex31, which skipped
+*               spaces and line-breaks.
+***********************************************************************************/
+void setModel(const char *rules) {
+    memset(modelIgnores, 0, sizeof(modelIgnores));
+    modelFolds = 0;
+    char *list = strdup(rules), *state;
+    for (char *rule = strtok_r(list, ",", &state); rule != NULL; rule = strtok_r(NULL, ",", &state)) {
+        modelIgnores[' '] |= !strcmp(rule, "space") || !strcmp(rule, "blank");
+        modelIgnores['\n'] |= !strcmp(rule, "newline") || !strcmp(rule, "blank");
+        modelIgnores['\t'] |= !strcmp(rule, "tab") || !strcmp(rule, "blank");
+        modelIgnores['\r'] |= !strcmp(rule, "return") || !strcmp(rule, "blank");
+        modelIgnores['\v'] |= !strcmp(rule, "blank");
+        modelIgnores['\f'] |= !strcmp(rule, "blank");
+        modelFolds |= !strcmp(rule, "case");
+    }
+    free(list);
+}
+
+/**********************************************************************************
+* Function:     ignored
+* Input:        A byte.
+* Output:       1 if similarity ignores it, 0 otherwise.
+* Operation:    The model of what selectiveReadByte() of the original ex31
+*               skipped, by the rules.
+***********************************************************************************/
+int ignored(unsigned char ch) {
+    return modelIgnores[ch];
+}
+
+/**********************************************************************************
+* Function:     folded
+* Input:        A byte.
+* Output:       The byte as similarity compares it.
+* Operation:    The model of areSimilar() of the original ex31 -- ASCII letters
+*               match regardless of case (if the rules fold it), anything else
+*               only itself.
+***********************************************************************************/
+unsigned char folded(unsigned char ch) {
+    return modelFolds && 'a' <= ch && ch <= 'z' ? ch - 32 : ch;
+}
+
+/**********************************************************************************
+* Function:     compareModel
+* Input:        Two buffers and their lengths.
+* Output:       1 for identical, 2 for different, 3 for similar.
+* Operation:    The scalar model the kernels are checked against -- the identity
+*               loop of the original ex31, and then its similarity loop a byte at
+*               a time (selectiveReadByte() and areSimilar()), without the stale
+*               last byte and the 0xff end of file it had (see edgeCases).
+***********************************************************************************/
+int compareModel(const unsigned char *src, size_t srcLength, const unsigned char *dst, size_t dstLength) {
+
+    // Identity loop.
+    if (srcLength == dstLength && !memcmp(src, dst, srcLength)) {
+        return IDENTICAL;
+    }
+
+    // Similarity loop -- skip what is ignored, and compare the rest folded.
+    size_t i = 0, j = 0;
+    for (;;) {
+        while (i < srcLength && ignored(src[i])) {
+            ++i;
+        }
+        while (j < dstLength && ignored(dst[j])) {
+            ++j;
+        }
+        if (i == srcLength || j == dstLength) {
+            return i == srcLength && j == dstLength ? SIMILAR : DIFFERENT;
+        }
+        if (folded(src[i++]) != folded(dst[j++])) {
+            return DIFFERENT;
+        }
+    }
+
+}
+
+/**********************************************************************************
+* Function:     writeFile
+* Input:        A buffer and its length, and the byte and length of a prefix.
+* Output:       A File Descriptor of a temporary file that holds the prefix and
+*               the buffer (at the offset of the buffer), or -1 for error.
+* Operation:    Writes the prefix and the buffer to an unnamed temporary file.
+***********************************************************************************/
+int writeFile(const unsigned char *data, size_t length, char prefix, size_t prefixLength) {
+    int fd = open("/tmp", O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+    char junk[PREFIX_LENGTH];
+    memset(junk, prefix, sizeof(junk));
+    if (prefixLength > sizeof(junk) || write(fd, junk, prefixLength) != (ssize_t)prefixLength) {
+        close(fd);
+        return ERROR;
+    }
+    for (size_t done = 0; done < length;) {
+        ssize_t written = write(fd, data + done, length - done);
+        if (written <= 0) {
+            close(fd);
+            return ERROR;
+        }
+        done += written;
+    }
+    lseek(fd, prefixLength, SEEK_SET);
+    return fd;
+}
+
+/**********************************************************************************
+* Function:     openPipe
+* Input:        A buffer and its length.
+* Output:       The read end of a pipe that a child fills with the buffer, or -1
+*               for error.
+* Operation:    Forks a child that writes the buffer to a pipe and exits, so the
+*               comparator reads it in blocks rather than mapping it.
+***********************************************************************************/
+int openPipe(const unsigned char *data, size_t length) {
+    int fds[2];
+    if (pipe(fds) == ERROR) {
+        return ERROR;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        for (size_t done = 0; done < length;) {
+            ssize_t written = write(fds[1], data + done, length - done);
+            if (written <= 0) {
+                _exit(1);
+            }
+            done += written;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return ERROR;
+    }
+    return fds[0];
+}
+
+/**********************************************************************************
+* Function:     report
+* Input:        The pair (its name), the entry point, and the verdicts.
+* Output:       None.
+* Operation:    Counts a mismatch, and prints the first REPORTED of them.
+***********************************************************************************/
+void report(const char *pair, const char *entry, int expected, int got) {
+    if (mismatches++ < REPORTED) {
+        char line[256];
+        snprintf(line, sizeof(line), "mismatch: %s, %s: expected %d, got %d\n", pair, entry, expected, got);
+        print(line);
+    }
+}
+
+/**********************************************************************************
+* Function:     checkPair
+* Input:        The name of the pair, the pair, the verdict it must get, and
+*               whether to read it through pipes too.
+* Output:       None.
+* Operation:    Compares the pair with every entry point of the comparator --
+*               compareBuffers() both ways, compareFDs() on temporary files (and
+*               on pipes), a stream fed to a reference in pieces of random size,
+*               and compareToReference(), and the last two on files past prefixes
+*               that differ -- and reports the ones that disagree.
+***********************************************************************************/
+void checkPair(const char *pair, const unsigned char *src, size_t srcLength, const unsigned char *dst,
+               size_t dstLength, int expected, int pipes) {
+
+    // Buffers.
+    int got = compareBuffers(src, srcLength, dst, dstLength);
+    if (got != expected) {
+        report(pair, "compareBuffers", expected, got);
+    }
+    got = compareBuffers(dst, dstLength, src, srcLength);
+    if (got != expected) {
+        report(pair, "compareBuffers (swapped)", expected, got);
+    }
+
+    // Files, mapped or read in blocks by their size.
+    int srcFD = writeFile(src, srcLength, 0, 0), dstFD = writeFile(dst, dstLength, 0, 0);
+    got = srcFD != ERROR && dstFD != ERROR ? compareFDs(srcFD, dstFD) : READ_ERROR;
+    if (got != expected) {
+        report(pair, "compareFDs", expected, got);
+    }
+
+    // Pipes, read in blocks whatever their size.
+    if (pipes) {
+        int srcPipe = openPipe(src, srcLength), dstPipe = openPipe(dst, dstLength);
+        got = srcPipe != ERROR && dstPipe != ERROR ? compareFDs(srcPipe, dstPipe) : READ_ERROR;
+        if (got != expected) {
+            report(pair, "compareFDs (pipes)", expected, got);
+        }
+        if (srcPipe != ERROR) {
+            close(srcPipe);
+        }
+        if (dstPipe != ERROR) {
+            close(dstPipe);
+        }
+        while (wait(NULL) > 0) {
+        }
+    }
+
+    // A stream against the reference of dst, fed in pieces, and src as a file against it.
+    Reference reference;
+    if (dstFD != ERROR && lseek(dstFD, 0, SEEK_SET) == 0 && loadReference(&reference, dstFD) == SUCCESS) {
+        Comparison comparison;
+        got = beginComparison(&comparison, &reference) == SUCCESS ? SUCCESS : READ_ERROR;
+        for (size_t done = 0; got == SUCCESS && done < srcLength;) {
+            size_t piece = rand() % 4 ? rand() % 64 + 1 : rand() % 100000 + 1;
+            piece = piece < srcLength - done ? piece : srcLength - done;
+            feedComparison(&comparison, src + done, piece);
+            done += piece;
+        }
+        got = got == SUCCESS ? endComparison(&comparison) : got;
+        if (got != expected) {
+            report(pair, "feedComparison", expected, got);
+        }
+        got = lseek(srcFD, 0, SEEK_SET) == 0 ? compareToReference(srcFD, &reference) : READ_ERROR;
+        if (got != expected) {
+            report(pair, "compareToReference", expected, got);
+        }
+        releaseReference(&reference);
+    } else {
+        report(pair, "loadReference", expected, READ_ERROR);
+    }
+    if (srcFD != ERROR) {
+        close(srcFD);
+    }
+    if (dstFD != ERROR) {
+        close(dstFD);
+    }
+
+    // Files from their current offsets, past prefixes that differ -- so reading from offset 0 is caught.
+    srcFD = writeFile(src, srcLength, '<', PREFIX_LENGTH);
+    dstFD = writeFile(dst, dstLength, '>', PREFIX_LENGTH);
+    got = srcFD != ERROR && dstFD != ERROR ? compareFDs(srcFD, dstFD) : READ_ERROR;
+    if (got != expected) {
+        report(pair, "compareFDs (offset)", expected, got);
+    }
+    if (dstFD != ERROR && lseek(dstFD, PREFIX_LENGTH, SEEK_SET) == PREFIX_LENGTH
+        && loadReference(&reference, dstFD) == SUCCESS) {
+        got = lseek(srcFD, PREFIX_LENGTH, SEEK_SET) == PREFIX_LENGTH ? compareToReference(srcFD, &reference)
+                                                                     : READ_ERROR;
+        if (got != expected) {
+            report(pair, "compareToReference (offset)", expected, got);
+        }
+        releaseReference(&reference);
+    } else {
+        report(pair, "loadReference (offset)", expected, READ_ERROR);
+    }
+    if (srcFD != ERROR) {
+        close(srcFD);
+    }
+    if (dstFD != ERROR) {
+        close(dstFD);
+    }
+
+}
+
+/**********************************************************************************
+* Function:     generatePair
+* Input:        Two buffers of MAX_LENGTH bytes, and pointers for the lengths.
+* Output:       None.
+* Operation:    Fills src with random bytes -- mostly letters and whitespace, a
+*               few symbols, control bytes and bytes above 0x7f -- and dst with a
+*               copy of it that is perturbed here and there: bytes dropped,
+*               whitespace (sometimes a long run) added, bit 0x20 flipped (the
+*               case of a letter), or a byte replaced. Most pairs are short, a few span many blocks.
+***********************************************************************************/
+void generatePair(unsigned char *src, size_t *srcLength, unsigned char *dst, size_t *dstLength) {
+    static const char alphabet[] = " \n \n\t\r\v\fabcxyzABCXYZ019@`[{\0\x80\xe0\xc0\xff";
+    int size = rand() % 100;
+    size_t length = size < 90 ? rand() % 512 : size < 99 ? rand() % (1 << 17) : rand() % (MAX_LENGTH / 2);
+    for (size_t i = 0; i < length; ++i) {
+        src[i] = rand() % 3 ? alphabet[rand() % (sizeof(alphabet) - 1)] : 'a' + rand() % 26;
+    }
+    int rate = rand() % 4 ? 1000 : 20;
+    size_t count = 0;
+    for (size_t i = 0; i < length && count < MAX_LENGTH - 1; ++i) {
+        unsigned char ch = src[i];
+        int operation = rand() % rate;
+        if (operation == 0) {
+            continue;
+        }
+        if (operation == 1) {
+            size_t run = rand() % 50 ? rand() % 4 + 1 : rand() % 100000 + 1;
+            for (; run > 0 && count < MAX_LENGTH - 2; --run) {
+                dst[count++] = rand() % 2 ? ' ' : '\n';
+            }
+        } else if (operation == 2) {
+            ch ^= 0x20;
+        } else if (operation == 3) {
+            ch = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        dst[count++] = ch;
+    }
+    *srcLength = length;
+    *dstLength = count;
+}
+
+/**********************************************************************************
+* Function:     checkKernel
+* Input:        The kernel, the rules, the number of random pairs, and the seed.
+* Output:       0 if every pair got the verdict of the model, -1 otherwise.
+* Operation:    Runs in a child of its own, as the comparator picks its kernels
+*               and builds its tables once per process -- forces the kernel with
+*               COMP_KERNEL, sets the rules, checks the edge cases of the rules
+*               and the random pairs with every entry point (see checkPair()),
+*               and prints a JSON line with the counts.
+***********************************************************************************/
+int checkKernel(const char *kernel, const char *rules, int pairs, unsigned seed) {
+
+    // Force the kernel, and set the rules.
+    setenv("COMP_KERNEL", kernel, 1);
+    srand(seed);
+    if (setNormalization(rules) == ERROR) {
+        print(USAGE);
+        return ERROR;
+    }
+    setModel(rules);
+
+    // The edge cases of the rules -- the model must agree with them too.
+    int edges = 0;
+    for (size_t i = 0; i < sizeof(edgeCases) / sizeof(EdgeCase); ++i) {
+        const EdgeCase *edge = &edgeCases[i];
+        if (strcmp(edge->rules != NULL ? edge->rules : NORMALIZATION_DEFAULT, rules)) {
+            continue;
+        }
+        ++edges;
+        const unsigned char *src = (const unsigned char *)edge->src, *dst = (const unsigned char *)edge->dst;
+        int model = compareModel(src, edge->srcLength, dst, edge->dstLength);
+        if (model != edge->expected) {
+            report(edge->name, "model", edge->expected, model);
+        }
+        checkPair(edge->name, src, edge->srcLength, dst, edge->dstLength, edge->expected, 1);
+    }
+
+    // The random pairs.
+    unsigned char *src = malloc(MAX_LENGTH), *dst = malloc(MAX_LENGTH);
+    if (src == NULL || dst == NULL) {
+        print("Error in: malloc\n");
+        return ERROR;
+    }
+    for (int i = 0; i < pairs; ++i) {
+        size_t srcLength, dstLength;
+        char name[32];
+        generatePair(src, &srcLength, dst, &dstLength);
+        snprintf(name, sizeof(name), "pair %d", i);
+        int expected = compareModel(src, srcLength, dst, dstLength);
+        checkPair(name, src, srcLength, dst, dstLength, expected, i % 8 == 0);
+    }
+    free(src);
+    free(dst);
+
+    // Report.
+    char line[256];
+    snprintf(line, sizeof(line), "{\"kernel\":\"%s\",\"rules\":\"%s\",\"edge_cases\":%d,\"pairs\":%d,"
+             "\"mismatches\":%d}\n", kernel, rules, edges, pairs, mismatches);
+    print(line);
+    return mismatches == 0 ? SUCCESS : ERROR;
+
+}
+
+/**********************************************************************************
+* Function:     main
+* Input:        argc, argv -- [-k KERNELS] [-r RULES] [-n PAIRS] [-s SEED].
+* Output:       0 if every kernel agreed with the model, -1 otherwise.
+* Operation:    Entry point of the program. A differential test of the kernels of
+*               comparator.c against a scalar model of the original ex31. First
+*               checks which lists of rules setNormalization() accepts (see
+*               parserCases). -k lists the kernels to force (scalar, sse2,
+*               sse4.2 and avx2), -r the one set of rules to check them under
+*               (all of ruleSets by default), -n sets the number of random pairs
+*               (500) and -s their seed (1). Every kernel is checked under every
+*               set of rules in a child of its own. A kernel the CPU doesn't
+*               support falls back to a narrower one, as it does anyway.
+***********************************************************************************/
+int main(int argc, char **argv) {
+
+    // Parse options.
+    char *kernels = DEFAULT_KERNELS;
+    const char **rules = ruleSets, *chosen;
+    int ruleCount = sizeof(ruleSets) / sizeof(ruleSets[0]);
+    int pairs = DEFAULT_PAIRS, option;
+    unsigned seed = DEFAULT_SEED;
+    while ((option = getopt(argc, argv, "k:r:n:s:")) != -1) {
+        if (option == 'k') {
+            kernels = optarg;
+        } else if (option == 'r') {
+            chosen = optarg;
+            rules = &chosen;
+            ruleCount = 1;
+        } else if (option == 'n') {
+            pairs = strtol(optarg, NULL, 10);
+        } else if (option == 's') {
+            seed = strtoul(optarg, NULL, 10);
+        } else {
+            print(USAGE);
+            exit(ERROR);
+        }
+    }
+
+    // Check the parser -- nothing is compared in this process, so the rules may be set over and over.
+    int status = SUCCESS, mismatched = 0;
+    for (size_t i = 0; i < sizeof(parserCases) / sizeof(ParserCase); ++i) {
+        int accepted = setNormalization(parserCases[i].rules) == SUCCESS;
+        if (accepted != parserCases[i].valid) {
+            char line[128];
+            snprintf(line, sizeof(line), "mismatch: rules \"%s\" were %s\n", parserCases[i].rules,
+                     accepted ? "accepted" : "rejected");
+            print(line);
+            status = ERROR;
+            ++mismatched;
+        }
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "{\"parser_cases\":%zu,\"mismatches\":%d}\n",
+             sizeof(parserCases) / sizeof(ParserCase), mismatched);
+    print(line);
+
+    // Check every kernel under every set of rules in a child of its own.
+    for (int r = 0; r < ruleCount; ++r) {
+        char *kernelList = strdup(kernels), *state;
+        for (char *kernel = strtok_r(kernelList, ",", &state); kernel != NULL;
+             kernel = strtok_r(NULL, ",", &state)) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(checkKernel(kernel, rules[r], pairs, seed) == SUCCESS ? SUCCESS : 1);
+            }
+            int childStatus;
+            if (pid < 0 || waitpid(pid, &childStatus, 0) == ERROR || !WIFEXITED(childStatus)
+                || WEXITSTATUS(childStatus) != SUCCESS) {
+                status = ERROR;
+            }
+        }
+        free(kernelList);
+    }
+    if (status != SUCCESS) {
+        exit(ERROR);
+    }
+    return SUCCESS;
+
+}
@@ -4,151 +4,294 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include "comparator.h"
 
-// Define possible results according to exercise instructions.
-#define IDENTICAL 1
-#define SIMILAR   3
-#define DIFFERENT 2
+// Define the most threads a batch compares with.
+#define MAX_THREADS 64
 
 /**********************************************************************************
-* Function:     selectiveReadByte
-* Input:        int fd - File Descriptor.
-* Output:       char - one byte.
-* Operation:    This function uses fd to read the first byte which isn't a space or
-*               a line-break and return it. If there is no such byte untill th end
-*               of the file, it will return -1, which is not a valic ASCII char.
+* Struct:       Batch
+* Operation:    A reference and the candidates to compare against it -- their
+*               paths and verdicts (0 until known), the next candidate to take,
+*               and the next one to print. The lock guards the printing, so the
+*               lines come out in the order of the candidates.
 ***********************************************************************************/
-char selectiveReadByte(int fd) {
-    char ch = 0;
-    if (!read(fd, &ch, 1))
-        return -1;
-    if (ch != ' ' && ch != '\n')
-        return ch;
-    return selectiveReadByte(fd);
+typedef struct {
+    const Reference *reference;
+    char **paths;
+    int *verdicts;
+    int count;
+    int next;
+    int printed;
+    pthread_mutex_t lock;
+} Batch;
+
+/**********************************************************************************
+* Function:     verdictName
+* Input:        int verdict -- the result of a comparison.
+* Output:       Its name.
+* Operation:    Names a verdict for the lines of a batch.
+***********************************************************************************/
+const char *verdictName(int verdict) {
+    if (verdict == IDENTICAL) {
+        return "IDENTICAL";
+    }
+    if (verdict == SIMILAR) {
+        return "SIMILAR";
+    }
+    return verdict == DIFFERENT ? "DIFFERENT" : "ERROR";
 }
 
 /**********************************************************************************
-* Function:     areSimilar
-* Input:        ch1, ch2 -- two characters.
-* Output:       1 if ch1 is similar to ch2, 0 otherwise.
-* Operation:    This function checks for similarity between two given characters.
-*               It suppose the given characrers are not spaces nor line-breaks, so 
-*               according to the exercise's instructions, similarity is defined by
-*               if one is equal to the other, or one is a capital of the other.        
+* Function:     compareTask
+* Input:        Batch *batch (as void *).
+* Output:       NULL.
+* Operation:    The body of a thread of a batch. Takes candidates one by one and
+*               compares each against the reference. Once a verdict is known, it
+*               prints every verdict that is known from the next one to print on.
 ***********************************************************************************/
-char areSimilar(char ch1, char ch2) {
-    
-    // if the characters are the same, or one is the capital of the other, return 1 for true.
-    if (ch1 == ch2)
-        return 1;
-    if ('A' <= ch1 && ch1 <= 'Z' && ch2 == ch1 + 32)
-        return 1;
-    if ('a' <= ch1 && ch1 <= 'z' && ch2 == ch1 - 32)
-        return 1;
-
-    // Else, return 0 for false, means there is a significant difference between the characters.
-    return 0;
+void *compareTask(void *argument) {
+    Batch *batch = argument;
+    int i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+
+        // Compare the candidate (a candidate that can't be opened is an error).
+        int verdict = READ_ERROR;
+        int fd = open(batch->paths[i], O_RDONLY);
+        if (fd != -1) {
+            verdict = compareToReference(fd, batch->reference);
+            close(fd);
+        }
+
+        // Print the verdicts that are due.
+        pthread_mutex_lock(&batch->lock);
+        batch->verdicts[i] = verdict;
+        while (batch->printed < batch->count && batch->verdicts[batch->printed] != 0) {
+            printf("%s\t%s\n", batch->paths[batch->printed], verdictName(batch->verdicts[batch->printed]));
+            ++batch->printed;
+        }
+        pthread_mutex_unlock(&batch->lock);
 
+    }
+    return NULL;
 }
 
 /**********************************************************************************
-* Function:     main
-* Input:        argc, argv -- standard input.
-* Output:       int -- 1 for identical, 2 for different, and 3 for similar.
-* Operation:    Entry point of the program.
+* Function:     readPaths
+* Input:        The separator of the paths, and pointers for the paths array and
+*               its size.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads the standard input and splits it to paths by the separator
+*               ('\n' or '\0'), skipping empty ones. The paths point into one
+*               buffer, which is the first of them.
 ***********************************************************************************/
-int main(int argc, char **argv) {
+int readPaths(char separator, char ***paths, int *count) {
 
-    // Not enough arguments.
-    if (argc < 3) {
-        exit(-1);
+    // Read the whole input.
+    size_t length = 0, capacity = 1 << 16;
+    char *buffer = malloc(capacity + 1);
+    ssize_t received = 0;
+    while (buffer != NULL && (received = read(STDIN_FILENO, buffer + length, capacity - length)) > 0) {
+        length += received;
+        if (length == capacity) {
+            capacity *= 2;
+            char *grown = realloc(buffer, capacity + 1);
+            if (grown == NULL) {
+                free(buffer);
+            }
+            buffer = grown;
+        }
+    }
+    if (buffer == NULL || received == -1) {
+        free(buffer);
+        return -1;
     }
+    buffer[length] = separator;
 
-    // Try to open source file.
-    int srcFD = open(argv[1], O_RDONLY);
-    if (srcFD == -1) {
-        printf("Error in: open");
-        exit(-1);
+    // Split it. There are at most as many paths as separators.
+    int total = 0;
+    for (size_t i = 0; i <= length; ++i) {
+        total += buffer[i] == separator;
+    }
+    *paths = malloc(total * sizeof(char *));
+    if (*paths == NULL) {
+        free(buffer);
+        return -1;
+    }
+    *count = 0;
+    for (size_t begin = 0, end; begin < length; begin = end + 1) {
+        for (end = begin; buffer[end] != separator; ++end) {
+        }
+        buffer[end] = '\0';
+        if (end > begin) {
+            (*paths)[(*count)++] = buffer + begin;
+        }
     }
+    if (*count == 0) {
+        free(buffer);
+    }
+    return 0;
 
-    // Try to open destination file.
-    int dstFD = open(argv[2], O_RDONLY);
-    if (dstFD == -1) {
+}
+
+/**********************************************************************************
+* Function:     runBatch
+* Input:        The path of the reference, the candidates and their number, and
+*               the number of threads.
+* Output:       int -- 1 if all the candidates are identical to the reference, 3 if
+*               they are all identical or similar, 2 if any is different, and -1
+*               if any can't be read (or the reference can't).
+* Operation:    Loads and normalizes the reference once, compares the candidates
+*               against it with a pool of threads, and prints a
+*               "<path>\t<verdict>" line for each, in their order.
+***********************************************************************************/
+int runBatch(const char *referencePath, char **paths, int count, int threads) {
+
+    // Load the reference.
+    Reference reference;
+    int fd = open(referencePath, O_RDONLY);
+    if (fd == -1) {
         printf("Error in: open");
-        close(srcFD);
-        exit(-1);
+        return -1;
     }
+    if (loadReference(&reference, fd) == -1) {
+        printf("Error in: read");
+        close(fd);
+        return -1;
+    }
+    close(fd);
 
-    // Initialize variables for read() function.
-    char srcChar = 0;
-    char dstChar = 0;
-    int srcRecv = 1;
-    int dstRecv = 1;
-
-    // Check for identity -- read() stops at the first different pair of chars (if exists).
-    srcRecv = read(srcFD, &srcChar, srcRecv);
-    dstRecv = read(dstFD, &dstChar, dstRecv);   
-    while ((srcRecv > 0) && (dstRecv > 0) && (srcChar == dstChar)) {
-        srcRecv = read(srcFD, &srcChar, srcRecv);
-        dstRecv = read(dstFD, &dstChar, dstRecv);   
+    // Compare the candidates.
+    Batch batch = {.reference = &reference, .paths = paths, .count = count};
+    batch.verdicts = calloc(count ? count : 1, sizeof(int));
+    if (batch.verdicts == NULL) {
+        printf("Error in: calloc");
+        releaseReference(&reference);
+        return -1;
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (; started < threads && started < count; ++started) {
+        if (pthread_create(&workers[started], NULL, compareTask, &batch) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        compareTask(&batch);
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
     }
 
-    // If the files' contents are identical, we can close resources and return 1.
-    if (srcChar == dstChar) {
-        close(srcFD);
-        close(dstFD);
-        return IDENTICAL;
+    // Sum the verdicts up.
+    int status = IDENTICAL;
+    for (int i = 0; i < count; ++i) {
+        if (batch.verdicts[i] == READ_ERROR) {
+            status = -1;
+        } else if (status == -1) {
+            continue;
+        } else if (batch.verdicts[i] == DIFFERENT) {
+            status = DIFFERENT;
+        } else if (batch.verdicts[i] == SIMILAR && status == IDENTICAL) {
+            status = SIMILAR;
+        }
     }
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.verdicts);
+    releaseReference(&reference);
+    return status;
 
-    // If contents aren't the same, change strategy to find differnce.
+}
 
-    // Handle edge-case: one file is completely read and the difference starts in the second file after that.
-    if (srcChar == ' ' || srcChar == '\n') {
-        srcChar = selectiveReadByte(srcFD);
-        if (srcChar == -1) {
-            dstChar = selectiveReadByte(dstFD);
-            if (dstChar == -1) {
-                return SIMILAR;
-            }
+/**********************************************************************************
+* Function:     main
+* Input:        argc, argv -- standard input: [-r RULES] <file> <file>, or
+*               [-r RULES] [-j N] [-0] -b <reference> [<file>...].
+* Output:       int -- 1 for identical, 2 for different, and 3 for similar.
+* Operation:    Entry point of the program. -r sets the rules of similarity (see
+*               setNormalization()). -b compares any number of files against
+*               one reference (see runBatch()) -- the files given after it, or
+*               else the ones listed in the standard input, one per line (or
+*               separated by '\0' with -0). -j sets how many threads compare
+*               them, and defaults to the number of online cores.
+***********************************************************************************/
+int main(int argc, char **argv) {
+
+    // Parse options.
+    const char *referencePath = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char separator = '\n';
+    int option;
+    while ((option = getopt(argc, argv, "r:b:j:0")) != -1) {
+        if (option == 'r' && setNormalization(optarg) == 0) {
+            continue;
+        } else if (option == 'b') {
+            referencePath = optarg;
+        } else if (option == 'j') {
+            threads = strtol(optarg, NULL, 10);
+        } else if (option == '0') {
+            separator = '\0';
+        } else {
+            exit(-1);
         }
     }
+    threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
 
-    // Same edge-case handling, but for the complement case where the other file is read first.
-    if (dstChar == ' ' || dstChar == '\n') { 
-        dstChar = selectiveReadByte(dstFD);
-        if (dstChar == -1) {
-            srcChar = selectiveReadByte(srcFD);
-            if (srcChar == -1) {
-                return SIMILAR;
+    // Batch mode -- compare the files of the arguments, or else of the standard input.
+    if (referencePath != NULL) {
+        char **paths = argv + optind;
+        int count = argc - optind;
+        if (count == 0 && readPaths(separator, &paths, &count) == -1) {
+            printf("Error in: read");
+            exit(-1);
+        }
+        int status = runBatch(referencePath, paths, count, threads);
+        if (paths != argv + optind) {
+            if (count > 0) {
+                free(paths[0]);
             }
+            free(paths);
+        }
+        if (status == -1) {
+            exit(-1);
         }
+        return status;
     }
 
-    // Difference checking loop.
-    do {
+    // Not enough arguments.
+    if (argc - optind < 2) {
+        exit(-1);
+    }
 
-        // If srcChar and dstChar are different, stop, release resources and return 2.
-        if (!areSimilar(srcChar, dstChar)) {
-            close(srcFD);
-            close(dstFD);
-            return DIFFERENT;
-        }
+    // Try to open source file.
+    int srcFD = open(argv[optind], O_RDONLY);
+    if (srcFD == -1) {
+        printf("Error in: open");
+        exit(-1);
+    }
 
-        // Else, read another pair of non-space non-line-break characters, and check them as well. 
-        srcChar = selectiveReadByte(srcFD);
-        dstChar = selectiveReadByte(dstFD);
+    // Try to open destination file.
+    int dstFD = open(argv[optind + 1], O_RDONLY);
+    if (dstFD == -1) {
+        printf("Error in: open");
+        close(srcFD);
+        exit(-1);
+    }
 
-    } while (srcChar != -1 && dstChar != -1);
+    // Compare the files.
+    int status = compareFDs(srcFD, dstFD);
 
     // Close File Descriptors.
     close(srcFD);
     close(dstFD);
 
-    // Make a final decision, if one file completely read while the other contains illegal characters,
-    // return 2 for different. Else, return 3 for similar.
-    if ((srcChar == -1 && dstChar != -1) || (dstChar == -1 && srcChar != -1)) { 
-        return DIFFERENT;
+    // Return 1 for identical, 2 for different or 3 for similar.
+    if (status == READ_ERROR) {
+        printf("Error in: read");
+        exit(-1);
     }
-    return SIMILAR;
+    return status;
 
-}
\ No newline at end of file
+}
@@ -1,35 +1,497 @@
 // Shlomi Ben-Shushan
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <getopt.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include "comparator.h"
 
-// Defines status codes.
+// Defines status codes (IDENTICAL, SIMILAR and DIFFERENT come from comparator.h).
 #define SUCCESS     0
-#define IDENTICAL   1
-#define SIMILAR     3
-#define DIFFERENT   2
 #define FAILURE     4   // A failure is a possible result, and does not require to exit the program.
 #define NOT_FOUND   5
 #define ERROR       -1
-#define TIMED_OUT   124 // Timeout return 124 if program timed-out.
+#define TIMED_OUT   124 // Returned by execute() when a program was killed for running out of time.
+#define DIVERGED    6   // Returned by execute() when a program was killed for its output.
+#define MEMORY_EXCEEDED 7   // Returned by execute() when a program was killed for running out of memory.
+#define CPU_EXCEEDED    8   // Returned by execute() when a program was killed for its CPU time.
+#define FILE_EXCEEDED   9   // Returned by execute() when a program was killed for writing a too large file.
+
+// Defines the time limit of a student's program in milliseconds, the default limit of its output in
+// MB (see -o), and the size of the pipe its output is read from.
+#define TIME_LIMIT      5000
+#define OUTPUT_LIMIT    64
+#define PIPE_SIZE       (1 << 20)
+
+// Defines the defaults of calibrating the time limits on a reference solution (see --reference) -- how many
+// times it runs on each case, the multiple of its wall time a program gets, and the least and most
+// milliseconds that multiple is bounded to.
+#define REFERENCE_RUNS  5
+#define TIMEOUT_FACTOR  3
+#define TIMEOUT_FLOOR   200
+#define TIMEOUT_CEILING 30000
+
+// Defines how much of an output is held back to be looked up in the output cache before it is compared
+// as it arrives instead, how long (in milliseconds) the output may pause before the held back part is
+// compared anyway, and the multiplier of the output fingerprint (see hashOutput()).
+#define CAPTURE_LIMIT   (1 << 20)
+#define CAPTURE_IDLE    50
+#define OUTPUT_PRIME    0x9E3779B97F4A7C15ULL
+
+// Defines the default resource limits of a student's program -- memory and file size in MB, and open files
+// (see --memory, --file-size and --open-files).
+#define MEMORY_LIMIT        512
+#define FILE_SIZE_LIMIT     64
+#define OPEN_FILES_LIMIT    64
+
+// Defines where the cgroup hierarchies are mounted -- cgroup v2, and the memory hierarchy of cgroup v1 --
+// the memory cgroup the programs of a process run in (see joinMemoryGroup()), and the leaf ex32 moves
+// itself to under cgroup v2 (see setupMemoryGroups()).
+#define CGROUP_ROOT         "/sys/fs/cgroup"
+#define CGROUP_V1_MEMORY    "/sys/fs/cgroup/memory"
+#define MEMORY_GROUP        "%s/ex32.%d"
+#define GRADER_GROUP        "%s/ex32.%d.grader"
+
+// Defines the backends execute() starts programs with (see --launcher), and the size of the stack a
+// spawned child runs on until it calls execvp().
+#define LAUNCH_SPAWN    0
+#define LAUNCH_FORK     1
+#define LAUNCH_STACK    (1 << 17)
+
+// Defines the formats of the results file, and the defaults of its sink -- the rows and milliseconds
+// between flushes (see -b and -i), and the initial size of its buffer.
+#define FORMAT_CSV      0
+#define FORMAT_JSONL    1
+#define FLUSH_ROWS      64
+#define FLUSH_INTERVAL  1000
+#define SINK_BUFFER     4096
 
-// Defines maximum sizes for conf.txt file reading buffer and system path size.
-#define PATH_MAX    4096
-#define CONF_MAX    600  // 150 chars * 3 lines + a little bit extra.
+// Defines maximum system path size, and the size of the buffer directory entries are read into in bulk.
+#define PATH_MAX        4096
+#define ENTRIES_BUFFER  (1 << 16)
 
 // Defines relative file locations.
 #define BINARY  "./b.out"
 #define OUTPUT  "./output.txt"
 #define RESULTS "./results.csv"
+#define RESULTS_JSONL "./results.jsonl"
 #define ERRORS  "./errors.txt"
-#define COMP    "./comp.out"
+#define SCRATCH "./ex32.XXXXXX"  // mkdtemp() template of a worker's scratch directory.
+#define TRACE   "./trace.json"   // The trace events of a worker, merged into the trace file (see --trace).
+
+// Defines how long a submission must stay unchanged before --watch grades it (in ms), the size of the buffer
+// inotify events are read into, and the events of a submission's directory that count as a change.
+#define WATCH_QUIET     2000
+#define WATCH_BUFFER    (1 << 16)
+#define WATCH_EVENTS    (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE \
+                         | IN_ONLYDIR)
+
+// Defines the number of phases a trace tells apart (see tracePhases).
+#define TRACE_PHASES    5
+
+// Defines the results and errors files of a shard (see --shard), by its index and the number of shards.
+#define SHARD_RESULTS       "./results.%dof%d.csv"
+#define SHARD_RESULTS_JSONL "./results.%dof%d.jsonl"
+#define SHARD_ERRORS        "./errors.%dof%d.txt"
+
+// Defines the offset basis of FNV-1a (see hashBytes()), and the getopt_long() values of the long options.
+#define FNV_OFFSET          0xCBF29CE484222325ULL
+#define OPTION_SHARD        256
+#define OPTION_MEMORY       257
+#define OPTION_CPU          258
+#define OPTION_PROCESSES    259
+#define OPTION_FILE_SIZE    260
+#define OPTION_OPEN_FILES   261
+#define OPTION_TRACE        262
+#define OPTION_LAUNCHER     263
+#define OPTION_INCREMENTAL  264
+#define OPTION_MEMFD        265
+#define OPTION_WATCH        266
+#define OPTION_RULES        267
+#define OPTION_REFERENCE    268
+#define OPTION_REFERENCE_RUNS   269
+#define OPTION_TIMEOUT_FACTOR   270
+#define OPTION_TIMEOUT_FLOOR    271
+#define OPTION_TIMEOUT_CEILING  272
+
+// Defines the files of the state directory of incremental runs (see --incremental) -- the manifest of
+// the last run, the manifest this run writes, and the directory of the outputs kept for recomparing --
+// and the manifest a worker writes in its scratch directory.
+#define MANIFEST        "/manifest"
+#define MANIFEST_NEXT   "/manifest.next"
+#define KEPT_OUTPUTS    "/outputs"
+#define WORKER_MANIFEST "./manifest.txt"
+#define MANIFEST_MAGIC  "ex32-manifest"
+#define INPUT_CHANGED       1
+#define EXPECTED_CHANGED    2
+
+// Defines the compiler, and the command line synopsis.
+#define COMPILER "gcc"
+#define USAGE    "Usage: ex32 [-j N] [-u] [-f] [-o MB] [-c DIR [-s MB]] [-F csv|jsonl] [-b ROWS] [-i MS] [-S] " \
+                 "[--shard I/N]\n" \
+                 "            [--memory MB] [--cpu S] [--processes N] [--file-size MB] [--open-files N] " \
+                 "[--trace FILE]\n" \
+                 "            [--launcher spawn|fork] [--incremental DIR] [--memfd] [--watch] [--rules RULES]\n" \
+                 "            [--reference FILE [--reference-runs N] [--timeout-factor X] [--timeout-floor MS] " \
+                 "[--timeout-ceiling MS]]\n" \
+                 "            <configuration file>\n" \
+                 "       ex32 merge [-F csv|jsonl] N <configuration file>\n"
+
+/**********************************************************************************
+* Struct:       Usage
+* Operation:    The resources a program used -- CPU time in user and kernel mode,
+*               maximum resident set size and wall time. valid is 0 until the
+*               program has run.
+***********************************************************************************/
+typedef struct {
+    long userMs;
+    long systemMs;
+    long maxRssKb;
+    long wallMs;
+    int valid;
+} Usage;
+
+// The usage of the submission graded now, and whether -u asked to add it to results.csv.
+Usage lastUsage;
+int usageColumns = 0;
+
+/**********************************************************************************
+* Struct:       Shared
+* Operation:    State shared by the parent and all the workers through an
+*               anonymous shared mapping -- the next submission to grade, and the
+*               hit and miss counters of the compilation cache and of the output
+*               caches, and how many submissions an incremental run reused and
+*               regraded.
+***********************************************************************************/
+typedef struct {
+    int next;
+    int cacheHits;
+    int cacheMisses;
+    int outputHits;
+    int outputMisses;
+    int reused;
+    int regraded;
+} Shared;
+Shared *shared;
+
+/**********************************************************************************
+* Struct:       TestCase
+* Operation:    An input file, the path of its correct output, and the correct
+*               output itself, loaded once for the whole run, and the time limit
+*               of its programs in ms -- TIME_LIMIT, or a multiple of the median
+*               wall time of a reference solution (see calibrateTimeouts()), which
+*               is kept along with its median CPU time. An incremental run also
+*               hashes the input and the correct output, and marks what changed
+*               since the last run (INPUT_CHANGED, EXPECTED_CHANGED).
+***********************************************************************************/
+typedef struct {
+    char *input;
+    char *correct;
+    Reference correctOutput;
+    long timeLimit;
+    long baselineWallMs;
+    long baselineCpuMs;
+    uint64_t inputHash;
+    uint64_t correctHash;
+    int changes;
+} TestCase;
+
+/**********************************************************************************
+* Struct:       Submission
+* Operation:    A sub-directory of the target directory, as collectSubmissions()
+*               found it -- its name, and the name of the C file it compiles (NULL
+*               if it has none), so grading it doesn't list it again.
+***********************************************************************************/
+typedef struct {
+    char *name;
+    char *source;
+} Submission;
+
+/**********************************************************************************
+* Struct:       Verdict
+* Operation:    A way a test case can end -- the status runCase() got, and the
+*               grade and reason it is given.
+***********************************************************************************/
+typedef struct {
+    int status;
+    int grade;
+    const char *reason;
+} Verdict;
+
+// Every way a test case can end. A program that broke a limit isn't misread as a WRONG answer.
+const Verdict verdicts[] = {
+    {TIMED_OUT, 20, "TIMEOUT"}, {MEMORY_EXCEEDED, 20, "MEMORY_LIMIT"}, {CPU_EXCEEDED, 20, "CPU_LIMIT"},
+    {FILE_EXCEEDED, 20, "FILE_LIMIT"}, {DIFFERENT, 50, "WRONG"}, {SIMILAR, 75, "SIMILAR"},
+    {IDENTICAL, 100, "EXCELLENT"}, {FAILURE, 0, "SKIPPED"}   // SKIPPED is a case -f didn't run.
+};
+
+/**********************************************************************************
+* Struct:       Capture
+* Operation:    The output of a program run on a test case. Up to CAPTURE_LIMIT
+*               bytes of it are held back in pending, so an output that was seen
+*               before is graded by the output cache without comparing it. Once
+*               it grows larger, or pauses for CAPTURE_IDLE ms while the program
+*               still runs, it is fed to the comparison as it arrives instead.
+***********************************************************************************/
+typedef struct {
+    const TestCase *testCase;
+    Comparison comparison;
+    unsigned char *pending;
+    size_t length;
+    size_t capacity;
+    int streaming;
+    struct timespec arrived;
+} Capture;
+
+/**********************************************************************************
+* Struct:       OutputEntry
+* Operation:    An entry of the output cache -- the fingerprint of an output (its
+*               hash and length), the test case it was the output of, and its
+*               verdict. An entry without a test case is empty.
+***********************************************************************************/
+typedef struct {
+    uint64_t hash;
+    size_t length;
+    const TestCase *testCase;
+    int verdict;
+} OutputEntry;
+
+// The output cache of this process -- an open addressing table of the verdicts of the outputs it graded,
+// by fingerprint, kept for the whole run. Its size is a power of 2 (or 0 before the first entry).
+OutputEntry *outputCache = NULL;
+size_t outputCacheSize = 0;
+size_t outputCacheCount = 0;
+
+// The verdicts of the test cases of the submission graded now (NULL for a case that didn't run), their
+// number, and whether -f asked to stop grading a submission at its first failing case.
+const char **caseReasons;
+int caseTotal;
+int failFast = 0;
+
+/**********************************************************************************
+* Struct:       ManifestEntry
+* Operation:    What the manifest of the last run holds about a submission -- the
+*               hash of its files, its grade and reason, the usage of its run, and
+*               the reason of each case along with the hash of its kept output (0
+*               for none). reasons and outputs are NULL for a submission that
+*               didn't run (NO_C_FILE or COMPILATION_ERROR).
+***********************************************************************************/
+typedef struct {
+    char *name;
+    uint64_t source;
+    char *grade;
+    char *reason;
+    Usage usage;
+    const char **reasons;
+    uint64_t *outputs;
+} ManifestEntry;
+
+// The state directory of an incremental run (NULL when disabled, see --incremental), the hash of the
+// settings the grades depend on, the entries of the last manifest sorted by name, and the manifest a
+// worker writes. The hash of the files of the submission graded now, and the hashes of its kept outputs.
+char *stateDirectory = NULL;
+uint64_t manifestSettings;
+ManifestEntry *manifestEntries = NULL;
+int manifestCount = 0;
+int manifestFD = ERROR;
+uint64_t currentSource;
+uint64_t *caseOutputs;
+
+/**********************************************************************************
+* Struct:       Watch
+* Operation:    The inotify watch of a submission's directory (see --watch) -- its
+*               watch descriptor, the submission's name (NULL once the watch is
+*               gone), and when the submission is due to be graded, in ms since
+*               the watch started (0 if it didn't change since it was graded).
+***********************************************************************************/
+typedef struct {
+    int wd;
+    char *name;
+    long due;
+} Watch;
+
+// Whether to keep grading as submissions change (see --watch), the inotify instance it uses and the watch of
+// the target directory in it, the watches of the submissions sorted by watch descriptor along with how many
+// of them are gone, the names of the submissions that went away (and when their rows are due to be
+// removed), and when the watch started.
+int watching = 0;
+int watchFD = ERROR;
+int targetWatch;
+Watch *watches = NULL;
+int watchCount = 0;
+int watchCapacity = 0;
+int watchesGone = 0;
+char **removedNames = NULL;
+int removedCount = 0;
+long removedDue = 0;
+struct timespec watchStart;
+
+/**********************************************************************************
+* Struct:       Sink
+* Operation:    The results file of this process, open for the whole run, and a
+*               buffer of the rows that are not written yet -- how many there are,
+*               and when the buffer was last flushed. The workers share the
+*               results file itself, and append their rows to it (O_APPEND) with
+*               one write() per flush, so rows of different workers are never
+*               interleaved.
+***********************************************************************************/
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    int rows;
+    struct timespec flushed;
+} Sink;
+Sink sink;
+
+// The results file and its format (see -F), when to flush its sink (see -b and -i), and whether to
+// sync it to the disk on every flush (see -S).
+const char *resultsFile = RESULTS;
+int resultsFormat = FORMAT_CSV;
+int flushRows = FLUSH_ROWS;
+long flushInterval = FLUSH_INTERVAL;
+int syncResults = 0;
+
+// The shard of the submissions this run grades (see --shard), the errors file it writes, and the names
+// of its files when sharded.
+int shardIndex = 0;
+int shardCount = 1;
+const char *errorsFile = ERRORS;
+char shardResults[64];
+char shardErrors[64];
+
+// The trace file (NULL when disabled, see --trace), the file the events of this process go to, the
+// start of the run, the lane of this process (0 for the parent, i + 1 for worker i), the submission
+// graded now, and the phases of the summary table.
+const char *traceFile = NULL;
+int traceFD = ERROR;
+struct timespec traceStart;
+int traceLane = 0;
+const char *traceSubmission = NULL;
+const char *tracePhases[TRACE_PHASES] = {"discover", "submission", "compile", "run", "compare"};
+
+// The most output bytes a program may write before it is killed and graded WRONG (see -o).
+long outputLimit = (long)OUTPUT_LIMIT << 20;
+
+// The reference solution the time limits are calibrated on (NULL to give every case TIME_LIMIT, see
+// --reference), how many times it runs on each case, how the time limit of a case follows from its wall
+// time (see --timeout-factor, --timeout-floor and --timeout-ceiling), and the calibrated cases, whose
+// baselines and time limits are added to every row of the results (NULL while not calibrated).
+const char *referenceSource = NULL;
+int referenceRuns = REFERENCE_RUNS;
+double timeoutFactor = TIMEOUT_FACTOR;
+long timeoutFloor = TIMEOUT_FLOOR;
+long timeoutCeiling = TIMEOUT_CEILING;
+const TestCase *calibrated = NULL;
+
+/**********************************************************************************
+* Struct:       Limits
+* Operation:    The resource limits a student's program runs under, set with
+*               setrlimit() right before execvp() -- memory and file size in
+*               bytes, CPU time in seconds, and the number of processes and of
+*               open files. 0 leaves a resource unlimited. The memory limit is
+*               the one of the program's memory cgroup (see joinMemoryGroup()),
+*               or RLIMIT_DATA (the heap and other private writable memory) where
+*               there is no memory cgroup.
+***********************************************************************************/
+typedef struct {
+    rlim_t memory;
+    rlim_t cpu;
+    rlim_t processes;
+    rlim_t fileSize;
+    rlim_t openFiles;
+} Limits;
+
+// The limits of every student's program (see --memory, --cpu, --processes, --file-size and --open-files).
+// CPU time is left to the time limit, and the number of processes is off by default, as RLIMIT_NPROC
+// counts every process of the user -- the grader and its workers too.
+Limits limits = {(rlim_t)MEMORY_LIMIT << 20, 0, 0, (rlim_t)FILE_SIZE_LIMIT << 20, OPEN_FILES_LIMIT};
+
+// The resources the limits apply to, in their order in Limits.
+const int limitResources[] = {RLIMIT_DATA, RLIMIT_CPU, RLIMIT_NPROC, RLIMIT_FSIZE, RLIMIT_NOFILE};
+
+/**********************************************************************************
+* Struct:       MemoryGroup
+* Operation:    The memory cgroup the programs of a process run in -- its
+*               directory, the FD of its cgroup.procs a child joins it through
+*               (-1 until it is made), and the process that made it (a forked
+*               worker makes one of its own).
+***********************************************************************************/
+typedef struct {
+    char path[PATH_MAX];
+    int procs;
+    pid_t owner;
+} MemoryGroup;
+
+// The directory memory cgroups are made in (NULL when there is none, see setupMemoryGroups()), whether it
+// is of cgroup v1, and the memory cgroup of this process.
+char *memoryGroups = NULL;
+int memoryGroupsV1 = 0;
+MemoryGroup memoryGroup = {"", ERROR, 0};
+
+/**********************************************************************************
+* Struct:       Launch
+* Operation:    What a child needs between its start and execvp() -- the command,
+*               the FDs its input, output and errors are redirected to (-1 to
+*               keep its own), its limits (NULL for none), the pipe it reports a
+*               failure through, and the FD of a program in memory to execute
+*               with fexecve() instead of the command's path (-1 for none), or of
+*               one the command writes through its /proc/self/fd path -- the
+*               compiler -- so it stays open in the command (-1 for none), and
+*               the cgroup.procs FD of the memory cgroup it joins (-1 for none).
+*               The parent prepares all of it, so the child only has to dup2()
+*               the FDs, join the cgroup, set the limits and execute.
+***********************************************************************************/
+typedef struct {
+    char **command;
+    int fds[3];
+    const Limits *limits;
+    int report[2];
+    int program;
+    int written;
+    int group;
+} Launch;
+
+// The backend children are started with (see --launcher), the stack a spawned child runs on, and the
+// names of the steps a child reports it failed at.
+int launcher = LAUNCH_SPAWN;
+char launchStack[LAUNCH_STACK] __attribute__((aligned(16)));
+const char *launchSteps[] = {"dup2", "setrlimit", "execvp", "cgroup"};
+
+// Whether --memfd asked to keep the binaries and the inputs off the disk, the FD of the binary in memory
+// (-1 while there is none), and the path the binary is compiled to and run from -- BINARY, or the
+// /proc/self/fd path of the FD.
+int diskless = 0;
+int binaryFD = ERROR;
+char binaryPath[32] = BINARY;
+
+// The compilation cache -- its directory (NULL when disabled, see -c), size bound in bytes, and the
+// identity of the compiler that is part of every key.
+char *cacheDirectory = NULL;
+off_t cacheLimit = 256L << 20;
+char compilerIdentity[PATH_MAX + 64];
 
 /**********************************************************************************
 * Function:     print
@@ -45,98 +507,377 @@ int print(const char *msg) {
 }
 
 /**********************************************************************************
-* Function:     writeToCSV
-* Input:        Folder's (student's) name, stringed grade, a reason for the grade.
+* Function:     elapsedMs
+* Input:        A start time taken from CLOCK_MONOTONIC.
+* Output:       The milliseconds passed since then.
+* Operation:    Measures wall time.
+***********************************************************************************/
+long elapsedMs(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**********************************************************************************
+* Function:     flushSink
+* Input:        None.
 * Output:       0 for success, -1 for error.
-* Operation:    This function creates a line of comma-seperated details and append
-*               it to result.csv file (creates file if not exists).
+* Operation:    Writes the buffered rows of the results sink to its file, and
+*               syncs the file to the disk if -S asked to.
 ***********************************************************************************/
-int writeToCSV(const char *name, const char *grade, const char *reason) {
+int flushSink(void) {
 
-    // Open the file in write-only-append mode -- create if not exist.
-    int csv = open(RESULTS, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (csv == ERROR) {
-        print("Error in: open\n");
+    // Write the whole buffer, even if write() takes it in parts.
+    for (size_t done = 0; done < sink.length;) {
+        ssize_t written = write(sink.fd, sink.buffer + done, sink.length - done);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print("Error in: write\n");
+            return ERROR;
+        }
+        done += written;
+    }
+    sink.length = 0;
+    sink.rows = 0;
+    clock_gettime(CLOCK_MONOTONIC, &sink.flushed);
+
+    // Sync if asked to.
+    if (syncResults && fsync(sink.fd) == ERROR) {
+        print("Error in: fsync\n");
         return ERROR;
     }
+    return SUCCESS;
 
-    // Create a comma-seperated line ends with line-break.
-    char string[strlen(name) + strlen(grade) + strlen(reason) + 4];
-    strcpy(string, name);
-    strcat(string, ",");
-    strcat(string, grade);
-    strcat(string, ",");
-    strcat(string, reason);
-    strcat(string, "\n");
+}
 
-    // Write to results.txt file, handle error if occured.
-    if (write(csv, string, strlen(string)) == ERROR) {
-        return ERROR;
+/**********************************************************************************
+* Function:     flushDue
+* Input:        None.
+* Output:       0 for success, -1 for error.
+* Operation:    Flushes the results sink if it holds rows and flushInterval ms
+*               passed since the last flush. It is checked for every row and after
+*               every case, so a row waits for about the interval plus one run at
+*               most, rather than for the next row.
+***********************************************************************************/
+int flushDue(void) {
+    if (sink.rows > 0 && elapsedMs(&sink.flushed) >= flushInterval) {
+        return flushSink();
     }
-    
-    // Release FD.
-    if (close(csv) != SUCCESS) {
-        print("Error in: close\n");
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     openSink
+* Input:        The results file to write.
+* Output:       0 for success, -1 for error.
+* Operation:    Opens the results file of this process (creates file if not
+*               exists) for the whole run, so rows are appended to a buffer
+*               instead of opening the file for each of them.
+***********************************************************************************/
+int openSink(const char *path) {
+    sink.fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (sink.fd == ERROR) {
+        print("Error in: open\n");
         return ERROR;
     }
-
-    // If all good, return SUCCESS.
+    sink.length = 0;
+    sink.rows = 0;
+    clock_gettime(CLOCK_MONOTONIC, &sink.flushed);
     return SUCCESS;
-    
 }
 
 /**********************************************************************************
-* Function:     ioRedirection
-* Input:        File path (with name) and an int which represents the desired FD.
+* Function:     closeSink
+* Input:        None.
 * Output:       0 for success, -1 for error.
-* Operation:    If newFD is 1 or 2, the function redirect output/errors to the
-*               given file. If newFD is 0, the it redirect the input from the given
-*               file. If something went wrong or newFD is not 0, 1 nor 2, the
-*               the function returns -1.
+* Operation:    Flushes the rows left in the results sink and closes its file.
 ***********************************************************************************/
-int ioRedirection(const char *file, int newFD) {
+int closeSink(void) {
+    int status = flushSink();
+    if (close(sink.fd) != SUCCESS) {
+        print("Error in: close\n");
+        status = ERROR;
+    }
+    free(sink.buffer);
+    sink.buffer = NULL;
+    sink.capacity = 0;
+    return status;
+}
 
-    // Output and errors redirection.
-    if (newFD == 1 || newFD == 2) {
-        int dstFD = open(file, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-        if (dstFD == ERROR) {
-            print("Error in: open\n");
+/**********************************************************************************
+* Function:     appendToSink
+* Input:        A printf() format and its arguments.
+* Output:       0 for success, -1 for error.
+* Operation:    Formats text at the end of the results sink's buffer, growing the
+*               buffer when it is too small.
+***********************************************************************************/
+__attribute__((format(printf, 1, 2)))
+int appendToSink(const char *format, ...) {
+    for (;;) {
+        va_list arguments;
+        va_start(arguments, format);
+        int length = vsnprintf(sink.buffer + sink.length, sink.capacity - sink.length, format, arguments);
+        va_end(arguments);
+        if (length < 0) {
             return ERROR;
         }
-        if (dup2(dstFD, newFD) == ERROR) {
-            close(dstFD);
-            print("Error in: dup2\n");
-            return ERROR;
+        if (sink.length + length < sink.capacity) {
+            sink.length += length;
+            return SUCCESS;
+        }
+        size_t capacity = sink.capacity ? sink.capacity * 2 : SINK_BUFFER;
+        while (capacity <= sink.length + length) {
+            capacity *= 2;
         }
-        if (close(dstFD) == ERROR) {
-            print("Error in: close\n");
+        char *buffer = realloc(sink.buffer, capacity);
+        if (buffer == NULL) {
+            print("Error in: realloc\n");
             return ERROR;
         }
-        return SUCCESS;
+        sink.buffer = buffer;
+        sink.capacity = capacity;
     }
+}
 
-    // Input redirection.
-    if (newFD == 0) {
-        int inFD = open(file, O_RDONLY);
-        if (inFD == ERROR) {
-            print("Error in: open\n");
-            return ERROR;
+/**********************************************************************************
+* Function:     quoteJSON
+* Input:        A string.
+* Output:       The string as a quoted JSON string (malloc()'d), or NULL for error.
+* Operation:    Escapes quotes, backslashes and control characters, and wraps the
+*               string with quotes.
+***********************************************************************************/
+char *quoteJSON(const char *string) {
+    char *quoted = malloc(strlen(string) * 6 + 3);
+    if (quoted == NULL) {
+        print("Error in: malloc\n");
+        return NULL;
+    }
+    char *q = quoted;
+    *q++ = '"';
+    for (const unsigned char *p = (const unsigned char *)string; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            q += sprintf(q, "\\%c", *p);
+        } else if (*p < 0x20) {
+            q += sprintf(q, "\\u%04x", *p);
+        } else {
+            *q++ = *p;
         }
-        if (dup2(inFD, newFD) == ERROR) {
-            print("Error in: dup2\n");
-            close(inFD);
-            return ERROR;
+    }
+    *q++ = '"';
+    *q = '\0';
+    return quoted;
+}
+
+/**********************************************************************************
+* Function:     appendJSONString
+* Input:        A string.
+* Output:       0 for success, -1 for error.
+* Operation:    Appends the string to the results sink as a quoted JSON string.
+***********************************************************************************/
+int appendJSONString(const char *string) {
+    char *quoted = quoteJSON(string);
+    if (quoted == NULL) {
+        return ERROR;
+    }
+    int status = appendToSink("%s", quoted);
+    free(quoted);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     recordSubmission
+* Input:        Folder's (student's) name, stringed grade, a reason for the grade.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the line of the submission to the manifest of this worker
+*               -- tab-separated name, hash of its files, grade, reason, usage,
+*               and a reason:output field for each case that ran.
+***********************************************************************************/
+int recordSubmission(const char *name, const char *grade, const char *reason) {
+
+    // Make room for the line.
+    size_t size = strlen(name) + strlen(grade) + strlen(reason) + 128 + (size_t)caseTotal * 48;
+    char *line = malloc(size);
+    if (line == NULL) {
+        print("Error in: malloc\n");
+        return ERROR;
+    }
+
+    // Write the submission, then its cases.
+    size_t length = snprintf(line, size, "%s\t%016lx\t%s\t%s\t%ld,%ld,%ld,%ld,%d", name,
+                             (unsigned long)currentSource, grade, reason, lastUsage.userMs, lastUsage.systemMs,
+                             lastUsage.maxRssKb, lastUsage.wallMs, lastUsage.valid);
+    for (int i = 0; i < caseTotal && caseReasons[i] != NULL; ++i) {
+        length += snprintf(line + length, size - length, "\t%s:%016lx", caseReasons[i],
+                           (unsigned long)caseOutputs[i]);
+    }
+    line[length++] = '\n';
+    int status = write(manifestFD, line, length) == (ssize_t)length ? SUCCESS : ERROR;
+    if (status == ERROR) {
+        print("Error in: write\n");
+    }
+    free(line);
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     writeResult
+* Input:        Folder's (student's) name, stringed grade, a reason for the grade.
+* Output:       0 for success, -1 for error.
+* Operation:    This function adds a row to the results sink, and flushes the sink
+*               once it holds flushRows rows or flushInterval ms passed since the
+*               last flush. A CSV row is a line of comma-seperated details, a JSON
+*               Lines row is an object with the same details. With more than one
+*               test case, the row also holds the verdict of each case. With -u,
+*               the row also holds the user CPU, system CPU and wall milliseconds
+*               and the max RSS (KB) of the graded program. With --reference, it
+*               also holds the wall and CPU milliseconds of the reference solution
+*               and the time limit of each case, so a TIMEOUT can be audited. An
+*               incremental run also records the submission in the manifest.
+***********************************************************************************/
+int writeResult(const char *name, const char *grade, const char *reason) {
+
+    int status;
+    if (resultsFormat == FORMAT_CSV) {
+
+        // Create a comma-seperated line ends with line-break -- empty columns for what didn't run.
+        status = appendToSink("%s,%s,%s", name, grade, reason);
+        for (int i = 0; caseTotal > 1 && i < caseTotal && status == SUCCESS; ++i) {
+            status = appendToSink(",%s", caseReasons[i] ? caseReasons[i] : "");
         }
-        if (close(inFD) == ERROR) {
-            print("Error in: close\n");
-            return ERROR;
+        if (usageColumns && status == SUCCESS) {
+            status = lastUsage.valid ? appendToSink(",%ld,%ld,%ld,%ld", lastUsage.userMs, lastUsage.systemMs,
+                                                    lastUsage.maxRssKb, lastUsage.wallMs)
+                                     : appendToSink(",,,,");
         }
-        return SUCCESS;
+        for (int i = 0; calibrated != NULL && i < caseTotal && status == SUCCESS; ++i) {
+            status = appendToSink(",%ld,%ld,%ld", calibrated[i].baselineWallMs, calibrated[i].baselineCpuMs,
+                                  calibrated[i].timeLimit);
+        }
+
+    } else {
+
+        // Create a JSON object in a line -- nulls for what didn't run.
+        status = appendToSink("{\"name\":");
+        if (status == SUCCESS) {
+            status = appendJSONString(name);
+        }
+        if (status == SUCCESS) {
+            status = appendToSink(",\"grade\":%s,\"reason\":\"%s\"", grade, reason);
+        }
+        for (int i = 0; caseTotal > 1 && i < caseTotal && status == SUCCESS; ++i) {
+            const char *separator = i == 0 ? ",\"cases\":[" : ",";
+            status = caseReasons[i] ? appendToSink("%s\"%s\"", separator, caseReasons[i])
+                                    : appendToSink("%snull", separator);
+        }
+        if (caseTotal > 1 && status == SUCCESS) {
+            status = appendToSink("]");
+        }
+        if (usageColumns && status == SUCCESS) {
+            status = lastUsage.valid
+                ? appendToSink(",\"user_ms\":%ld,\"sys_ms\":%ld,\"max_rss_kb\":%ld,\"wall_ms\":%ld",
+                               lastUsage.userMs, lastUsage.systemMs, lastUsage.maxRssKb, lastUsage.wallMs)
+                : appendToSink(",\"user_ms\":null,\"sys_ms\":null,\"max_rss_kb\":null,\"wall_ms\":null");
+        }
+        for (int i = 0; calibrated != NULL && i < caseTotal && status == SUCCESS; ++i) {
+            status = appendToSink("%s{\"baseline_wall_ms\":%ld,\"baseline_cpu_ms\":%ld,\"timeout_ms\":%ld}",
+                                  i == 0 ? ",\"timeouts\":[" : ",", calibrated[i].baselineWallMs,
+                                  calibrated[i].baselineCpuMs, calibrated[i].timeLimit);
+        }
+        if (calibrated != NULL && status == SUCCESS) {
+            status = appendToSink("]");
+        }
+        if (status == SUCCESS) {
+            status = appendToSink("}");
+        }
+
+    }
+    if (status == SUCCESS) {
+        status = appendToSink("\n");
+    }
+    if (status == SUCCESS && manifestFD != ERROR) {
+        status = recordSubmission(name, grade, reason);
+    }
+    if (status == ERROR) {
+        return ERROR;
+    }
+
+    // Flush once enough rows or time piled up.
+    if (++sink.rows >= flushRows) {
+        return flushSink();
+    }
+    return flushDue();
+
+}
+
+/**********************************************************************************
+* Function:     traceNow
+* Input:        None.
+* Output:       Microseconds since the run started, or 0 when not tracing.
+* Operation:    The clock of the trace (see --trace).
+***********************************************************************************/
+long traceNow(void) {
+    if (traceFile == NULL) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - traceStart.tv_sec) * 1000000 + (now.tv_nsec - traceStart.tv_nsec) / 1000;
+}
+
+/**********************************************************************************
+* Function:     traceEvent
+* Input:        A phase, and the time it began (see traceNow()).
+* Output:       None.
+* Operation:    Writes the phase, which ends now, as a complete ("X") Chrome trace
+*               event on the lane of this process, with the submission graded
+*               now (if any) as its argument. Every event takes a line of its
+*               own, and ends with a comma. Does nothing when not tracing.
+***********************************************************************************/
+void traceEvent(const char *phase, long begin) {
+    if (traceFD == ERROR) {
+        return;
     }
+    char *quoted = traceSubmission != NULL ? quoteJSON(traceSubmission) : NULL;
+    char event[PATH_MAX];
+    int length = snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld,\"pid\":1,"
+                          "\"tid\":%d%s%s%s},\n", phase, begin, traceNow() - begin, traceLane,
+                          quoted != NULL ? ",\"args\":{\"submission\":" : "", quoted != NULL ? quoted : "",
+                          quoted != NULL ? "}" : "");
+    free(quoted);
+    if (length > 0 && length < (int)sizeof(event) && write(traceFD, event, length) != length) {
+        print("Error in: write\n");
+    }
+}
+
+/**********************************************************************************
+* Function:     openRedirection
+* Input:        File path (with name) and an int which represents the desired FD.
+* Output:       An FD of the file, or -1 for error.
+* Operation:    If newFD is 1 or 2, the function opens the file for output/errors
+*               (appending to it, and creating it if needed). If newFD is 0, it
+*               opens the file for input. The FD is closed on exec, so only the
+*               copy the child makes of it (see launchChild()) outlives it. If
+*               something went wrong or newFD is not 0, 1 nor 2, the function
+*               returns -1.
+***********************************************************************************/
+int openRedirection(const char *file, int newFD) {
 
     // Illigal newFD.
-    return ERROR;
-    
+    if (newFD < 0 || newFD > 2) {
+        return ERROR;
+    }
+
+    // Open for output and errors, or for input.
+    int flags = newFD == 0 ? O_RDONLY | O_CLOEXEC : O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+    int fd = open(file, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == ERROR) {
+        print("Error in: open\n");
+    }
+    return fd;
+
 }
 
 /**********************************************************************************
@@ -156,432 +897,3761 @@ int safeRemove(const char *fileName) {
             return ERROR;
         }
     }
-
-    // Return 0 for success.
+
+    // Return 0 for success.
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     applyLimits
+* Input:        The limits to apply.
+* Output:       0 for success, -1 for error.
+* Operation:    Sets the resource limits of the calling process (the child, just
+*               before execvp()), which every process it forks inherits. A limit
+*               above the current hard limit is lowered to it, and the hard CPU
+*               limit is a second after the soft one, so the program gets SIGXCPU
+*               (and is told apart from a time-out) before it gets SIGKILL.
+*               Nothing is printed, as the child reports its failures to the
+*               parent (see launchChild()).
+***********************************************************************************/
+int applyLimits(const Limits *limits) {
+    const rlim_t values[] = {limits->memory, limits->cpu, limits->processes, limits->fileSize, limits->openFiles};
+    for (int i = 0; i < 5; ++i) {
+        struct rlimit limit;
+        if (values[i] == 0 || getrlimit(limitResources[i], &limit) == ERROR) {
+            continue;
+        }
+        rlim_t hard = limitResources[i] == RLIMIT_CPU ? values[i] + 1 : values[i];
+        if (limit.rlim_max != RLIM_INFINITY && hard > limit.rlim_max) {
+            hard = limit.rlim_max;
+        }
+        limit.rlim_cur = values[i] < hard ? values[i] : hard;
+        limit.rlim_max = hard;
+        if (setrlimit(limitResources[i], &limit) == ERROR) {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     readCgroup
+* Input:        A directory, a file in it, and a buffer and its size.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads a small file (of a cgroup) into the buffer as a string.
+***********************************************************************************/
+int readCgroup(const char *directory, const char *file, char *buffer, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directory, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+    ssize_t received = read(fd, buffer, size - 1);
+    close(fd);
+    if (received == ERROR) {
+        return ERROR;
+    }
+    buffer[received] = '\0';
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     writeCgroup
+* Input:        A directory, a file in it, and the value to write.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes a value to a file of a cgroup with one write().
+***********************************************************************************/
+int writeCgroup(const char *directory, const char *file, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directory, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+    int status = write(fd, value, strlen(value)) == (ssize_t)strlen(value) ? SUCCESS : ERROR;
+    close(fd);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     setupMemoryGroups
+* Input:        None.
+* Output:       0 for success, -1 if there is no memory cgroup to use.
+* Operation:    Finds where the memory cgroups of the programs can be made, and
+*               sets memoryGroups to it. Under cgroup v1, it is the memory cgroup
+*               of ex32, if ex32 may write to it. Under cgroup v2, it is the
+*               cgroup of ex32, if the memory controller is enabled for its
+*               children, or can be -- a cgroup with processes can't enable it,
+*               so ex32 first moves itself to a leaf of its own (ex32.PID.grader),
+*               which is left behind, and moves back if that doesn't help.
+***********************************************************************************/
+int setupMemoryGroups(void) {
+
+    // Find the cgroups of ex32 -- the memory one of cgroup v1, else the one of cgroup v2.
+    char content[4096], path[PATH_MAX], controls[512];
+    if (readCgroup("/proc/self", "cgroup", content, sizeof(content)) == ERROR) {
+        return ERROR;
+    }
+    char *unified = NULL, *next = content, *line;
+    while ((line = strsep(&next, "\n")) != NULL) {
+        char *controllers = strchr(line, ':'), *group = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+        if (group == NULL) {
+            continue;
+        }
+        *group++ = '\0';
+        if (*++controllers == '\0') {
+            unified = group;
+        }
+        snprintf(path, sizeof(path), CGROUP_V1_MEMORY "%s", group);
+        for (char *name; (name = strsep(&controllers, ",")) != NULL;) {
+            if (!strcmp(name, "memory") && access(path, W_OK) == SUCCESS) {
+                memoryGroups = strdup(path);
+                memoryGroupsV1 = 1;
+                return memoryGroups != NULL ? SUCCESS : ERROR;
+            }
+        }
+    }
+    if (unified == NULL) {
+        return ERROR;
+    }
+    snprintf(path, sizeof(path), CGROUP_ROOT "%s", unified);
+    if (readCgroup(path, "cgroup.controllers", controls, sizeof(controls)) == ERROR
+        || strstr(controls, "memory") == NULL) {
+        return ERROR;
+    }
+
+    // Enable the memory controller for the children of the cgroup v2 one, from a leaf of its own if needed.
+    if (readCgroup(path, "cgroup.subtree_control", controls, sizeof(controls)) == ERROR
+        || strstr(controls, "memory") == NULL) {
+        char leaf[PATH_MAX + 32];
+        snprintf(leaf, sizeof(leaf), GRADER_GROUP, path, getpid());
+        if (mkdir(leaf, S_IRWXU) == ERROR) {
+            return ERROR;
+        }
+        if (writeCgroup(leaf, "cgroup.procs", "0") == ERROR
+            || writeCgroup(path, "cgroup.subtree_control", "+memory") == ERROR) {
+            writeCgroup(path, "cgroup.procs", "0");
+            rmdir(leaf);
+            return ERROR;
+        }
+    }
+    memoryGroups = strdup(path);
+    return memoryGroups != NULL ? SUCCESS : ERROR;
+
+}
+
+/**********************************************************************************
+* Function:     countOomKills
+* Input:        None.
+* Output:       The OOM kills of the memory cgroup of this process, or -1 for
+*               error.
+* Operation:    Reads the oom_kill count of memory.events (cgroup v2), or of
+*               memory.oom_control (cgroup v1).
+***********************************************************************************/
+long countOomKills(void) {
+    char content[1024];
+    if (readCgroup(memoryGroup.path, memoryGroupsV1 ? "memory.oom_control" : "memory.events", content,
+                   sizeof(content)) == ERROR) {
+        return ERROR;
+    }
+    char *line = strstr(content, "oom_kill ");
+    return line != NULL ? strtol(line + strlen("oom_kill "), NULL, 10) : ERROR;
+}
+
+/**********************************************************************************
+* Function:     joinMemoryGroup
+* Input:        The limits of the program to run.
+* Output:       The cgroup.procs FD of the memory cgroup of this process, or -1
+*               for error.
+* Operation:    Makes the memory cgroup of this process the first time it runs a
+*               program (ex32.PID under memoryGroups), with the memory limit and
+*               no swap (where the kernel allows that). Every program of the
+*               process joins it before it executes (see launchChild()), so the
+*               memory limit is enforced by the kernel, which kills a program
+*               that runs out of it and counts that (see countOomKills()). If the
+*               cgroup can't be made or counted, this process falls back to
+*               RLIMIT_DATA.
+***********************************************************************************/
+int joinMemoryGroup(const Limits *limits) {
+    if (memoryGroup.owner == getpid()) {
+        return memoryGroup.procs;
+    }
+    if (memoryGroup.procs != ERROR) {
+        close(memoryGroup.procs);
+    }
+    char limit[32], procs[PATH_MAX + 16];
+    snprintf(limit, sizeof(limit), "%lu", (unsigned long)limits->memory);
+    snprintf(memoryGroup.path, sizeof(memoryGroup.path), MEMORY_GROUP, memoryGroups, getpid());
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", memoryGroup.path);
+    if ((mkdir(memoryGroup.path, S_IRWXU) == ERROR && errno != EEXIST)
+        || writeCgroup(memoryGroup.path, memoryGroupsV1 ? "memory.limit_in_bytes" : "memory.max", limit) == ERROR
+        || countOomKills() == ERROR || (memoryGroup.procs = open(procs, O_WRONLY | O_CLOEXEC)) == ERROR) {
+        print("Error in: cgroup\n");
+        rmdir(memoryGroup.path);
+        memoryGroup.procs = ERROR;
+        memoryGroups = NULL;
+        return ERROR;
+    }
+    writeCgroup(memoryGroup.path, memoryGroupsV1 ? "memory.memsw.limit_in_bytes" : "memory.swap.max",
+                memoryGroupsV1 ? limit : "0");
+    memoryGroup.owner = getpid();
+    return memoryGroup.procs;
+}
+
+/**********************************************************************************
+* Function:     leaveMemoryGroup
+* Input:        None.
+* Output:       None.
+* Operation:    Removes the memory cgroup of this process, if it made one. A
+*               cgroup that a program left a process in stays.
+***********************************************************************************/
+void leaveMemoryGroup(void) {
+    if (memoryGroup.owner != getpid()) {
+        return;
+    }
+    close(memoryGroup.procs);
+    memoryGroup.procs = ERROR;
+    memoryGroup.owner = 0;
+    rmdir(memoryGroup.path);
+}
+
+/**********************************************************************************
+* Function:     limitVerdict
+* Input:        The wait status and resource usage of a program that ran to its
+*               end, the limits it ran under, and whether its memory cgroup
+*               counted an OOM kill during the run.
+* Output:       7 if it ran out of memory, 8 if it ran out of CPU time, 9 if it
+*               wrote a too large file, or 0 if it kept its limits.
+* Operation:    Tells a program that broke a limit from one that just crashed.
+*               CPU time and file size are told by the signal the kernel sent --
+*               SIGXCPU (or SIGKILL at the hard limit) and SIGXFSZ. Memory is told
+*               by the OOM kills of the program's memory cgroup only, as a SIGKILL
+*               may come from anywhere (the program itself too). Without a memory
+*               cgroup, RLIMIT_DATA only makes allocations fail, and a program
+*               that crashes after one failed is graded like any crash.
+***********************************************************************************/
+int limitVerdict(int status, const struct rusage *usage, const Limits *limits, int outOfMemory) {
+    int signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    long cpuMs = (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000
+                 + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000;
+    if (signal == SIGXCPU || (signal == SIGKILL && limits->cpu && cpuMs >= (long)limits->cpu * 1000)) {
+        return CPU_EXCEEDED;
+    }
+    if (signal == SIGXFSZ) {
+        return FILE_EXCEEDED;
+    }
+    if (outOfMemory) {
+        return MEMORY_EXCEEDED;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     hashOutput
+* Input:        An output and its length.
+* Output:       The hash of the output.
+* Operation:    Hashes 32 bytes at a time in 4 independent lanes, so fingerprinting
+*               an output costs about as little as reading it. Together with the
+*               length, it tells the outputs of a class apart.
+***********************************************************************************/
+uint64_t hashOutput(const unsigned char *bytes, size_t length) {
+    uint64_t lanes[4] = {1, 2, 3, 4}, hash = length;
+    size_t i = 0;
+    for (; i + sizeof(lanes) <= length; i += sizeof(lanes)) {
+        for (int j = 0; j < 4; ++j) {
+            uint64_t word;
+            memcpy(&word, bytes + i + j * sizeof(word), sizeof(word));
+            lanes[j] = (lanes[j] ^ word) * OUTPUT_PRIME;
+            lanes[j] ^= lanes[j] >> 32;
+        }
+    }
+    for (int j = 0; j < 4; ++j) {
+        hash = (hash ^ lanes[j]) * OUTPUT_PRIME;
+    }
+    for (; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * OUTPUT_PRIME;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/**********************************************************************************
+* Function:     findOutput
+* Input:        The fingerprint of an output and its test case.
+* Output:       The entry of the output in the output cache, or the empty entry
+*               it belongs in.
+* Operation:    Probes the table linearly from the slot of the hash. The table is
+*               never more than half full, so an empty entry is always found.
+***********************************************************************************/
+OutputEntry *findOutput(uint64_t hash, size_t length, const TestCase *testCase) {
+    for (size_t i = hash & (outputCacheSize - 1);; i = (i + 1) & (outputCacheSize - 1)) {
+        OutputEntry *entry = &outputCache[i];
+        if (entry->testCase == NULL ||
+            (entry->hash == hash && entry->length == length && entry->testCase == testCase)) {
+            return entry;
+        }
+    }
+}
+
+/**********************************************************************************
+* Function:     rememberOutput
+* Input:        The fingerprint of an output, its test case and its verdict.
+* Output:       None.
+* Operation:    Adds the verdict to the output cache, doubling the table when it
+*               gets half full. Running out of memory only means the output will
+*               be compared again next time.
+***********************************************************************************/
+void rememberOutput(uint64_t hash, size_t length, const TestCase *testCase, int verdict) {
+
+    // Grow the table (rehashing its entries) when it gets half full.
+    if (2 * (outputCacheCount + 1) > outputCacheSize) {
+        size_t size = outputCacheSize ? 2 * outputCacheSize : 256;
+        OutputEntry *table = calloc(size, sizeof(OutputEntry)), *old = outputCache;
+        if (table == NULL) {
+            return;
+        }
+        size_t oldSize = outputCacheSize;
+        outputCache = table;
+        outputCacheSize = size;
+        for (size_t i = 0; i < oldSize; ++i) {
+            if (old[i].testCase != NULL) {
+                *findOutput(old[i].hash, old[i].length, old[i].testCase) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    // Add the entry.
+    *findOutput(hash, length, testCase) = (OutputEntry){hash, length, testCase, verdict};
+    ++outputCacheCount;
+
+}
+
+/**********************************************************************************
+* Function:     beginCapture
+* Input:        The capture to start, and the test case whose output it is.
+* Output:       0 for success, -1 for error.
+* Operation:    Starts capturing an output, holding it back for the output cache.
+***********************************************************************************/
+int beginCapture(Capture *capture, const TestCase *testCase) {
+    capture->testCase = testCase;
+    capture->pending = NULL;
+    capture->length = 0;
+    capture->capacity = 0;
+    capture->streaming = 0;
+    return beginComparison(&capture->comparison, &testCase->correctOutput);
+}
+
+/**********************************************************************************
+* Function:     streamCapture
+* Input:        A started capture.
+* Output:       DIFFERENT once the output is known to be WRONG, 0 while it isn't.
+* Operation:    Stops holding the output back -- feeds the held back part to the
+*               comparison, so the rest is compared as it arrives.
+***********************************************************************************/
+int streamCapture(Capture *capture) {
+    int status = SUCCESS;
+    if (!capture->streaming) {
+        capture->streaming = 1;
+        status = feedComparison(&capture->comparison, capture->pending, capture->length);
+        free(capture->pending);
+        capture->pending = NULL;
+        capture->length = 0;
+        capture->capacity = 0;
+    }
+    return status;
+}
+
+/**********************************************************************************
+* Function:     captureOutput
+* Input:        A started capture, the next bytes of the output and their length.
+* Output:       DIFFERENT once the output is known to be WRONG, 0 while it isn't.
+* Operation:    Holds the bytes back while the output fits in CAPTURE_LIMIT, and
+*               compares them as they arrive once it doesn't (see streamCapture()).
+***********************************************************************************/
+int captureOutput(Capture *capture, const void *data, size_t length) {
+
+    // Hold the bytes back, growing the buffer if needed.
+    if (!capture->streaming && capture->length + length <= CAPTURE_LIMIT) {
+        if (capture->length + length > capture->capacity) {
+            size_t capacity = capture->capacity ? capture->capacity : SINK_BUFFER;
+            while (capacity < capture->length + length) {
+                capacity *= 2;
+            }
+            unsigned char *pending = realloc(capture->pending, capacity);
+            if (pending == NULL) {
+                return streamCapture(capture) == DIFFERENT ? DIFFERENT
+                                                           : feedComparison(&capture->comparison, data, length);
+            }
+            capture->pending = pending;
+            capture->capacity = capacity;
+        }
+        memcpy(capture->pending + capture->length, data, length);
+        capture->length += length;
+        clock_gettime(CLOCK_MONOTONIC, &capture->arrived);
+        return SUCCESS;
+    }
+
+    // Compare them as they arrive otherwise.
+    if (streamCapture(capture) == DIFFERENT) {
+        return DIFFERENT;
+    }
+    return feedComparison(&capture->comparison, data, length);
+
+}
+
+/**********************************************************************************
+* Function:     endCapture
+* Input:        A started capture.
+* Output:       1 for identical, 2 for different, 3 for similar.
+* Operation:    Decides the verdict of the output once it is over, and releases
+*               the capture. A held back output is looked up in the output cache
+*               by its fingerprint, and only compared if it wasn't graded before.
+***********************************************************************************/
+int endCapture(Capture *capture) {
+
+    // An output that was compared as it arrived has its verdict already.
+    if (capture->streaming) {
+        return endComparison(&capture->comparison);
+    }
+
+    // Look the held back output up, and compare it only if it is new.
+    uint64_t hash = hashOutput(capture->pending, capture->length);
+    size_t length = capture->length;
+    if (outputCacheSize > 0) {
+        const OutputEntry *entry = findOutput(hash, length, capture->testCase);
+        if (entry->testCase != NULL) {
+            __atomic_fetch_add(&shared->outputHits, 1, __ATOMIC_RELAXED);
+            free(capture->pending);
+            endComparison(&capture->comparison);
+            return entry->verdict;
+        }
+    }
+    __atomic_fetch_add(&shared->outputMisses, 1, __ATOMIC_RELAXED);
+    streamCapture(capture);
+    int verdict = endComparison(&capture->comparison);
+    rememberOutput(hash, length, capture->testCase, verdict);
+    return verdict;
+
+}
+
+/**********************************************************************************
+* Function:     superviseChild
+* Input:        Child's pid, its start time, a time limit in milliseconds (0 for
+*               none), the read end of its output pipe and the capture to feed it
+*               to (-1 and NULL when the output isn't captured), and pointers for
+*               the wait status and the resource usage.
+* Output:       0 for success, -1 for error, 124 for time-out, or 6 if the output
+*               diverged from the correct output (or passed outputLimit).
+* Operation:    Waits for the child while feeding its output to the capture as it
+*               arrives, and kills its whole process group with SIGKILL as soon
+*               as the time limit expires or the output is known to be WRONG. A
+*               held back output is compared once it pauses for CAPTURE_IDLE ms,
+*               so a program that hangs after a WRONG output is killed too. The
+*               wait is a poll() on a pidfd and the pipe, with a 1 ms tick on
+*               kernels without pidfd_open(). The child is reaped with wait4(),
+*               which fills its resource usage.
+***********************************************************************************/
+int superviseChild(pid_t pid, const struct timespec *start, long timeLimit, int outputFD, Capture *capture,
+                   int *status, struct rusage *usage) {
+
+    int pidFD = syscall(SYS_pidfd_open, pid, 0);
+    int exited = 0, result = SUCCESS;
+    long received = 0;
+    char buffer[1 << 16];
+
+    // Loop until the child exited and its output (if captured) ended.
+    while (!exited || outputFD != ERROR) {
+
+        // Wait for output, for the exit of the child, or for the time limit.
+        struct pollfd events[2];
+        int count = 0, pidIndex = -1;
+        if (outputFD != ERROR) {
+            events[count++] = (struct pollfd){outputFD, POLLIN, 0};
+        }
+        if (!exited && pidFD != ERROR) {
+            pidIndex = count;
+            events[count++] = (struct pollfd){pidFD, POLLIN, 0};
+        }
+        long wait = -1;
+        if (timeLimit > 0 && (wait = timeLimit - elapsedMs(start)) <= 0) {
+            result = TIMED_OUT;
+            break;
+        }
+        if (!exited && pidFD == ERROR && (wait < 0 || wait > 1)) {
+            wait = 1;
+        }
+        if (!exited && capture != NULL && !capture->streaming && capture->length > 0) {
+            long idle = CAPTURE_IDLE - elapsedMs(&capture->arrived);
+            if (idle <= 0 && streamCapture(capture) == DIFFERENT) {
+                result = DIVERGED;
+                break;
+            }
+            if (idle > 0 && (wait < 0 || wait > idle)) {
+                wait = idle;
+            }
+        }
+        if (poll(events, count, wait) == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print("Error in: poll\n");
+            result = ERROR;
+            break;
+        }
+
+        // Feed the output to the capture, and stop the child once its verdict is settled.
+        if (outputFD != ERROR && events[0].revents) {
+            ssize_t got = read(outputFD, buffer, sizeof(buffer));
+            if (got > 0) {
+                received += got;
+                if (received > outputLimit || captureOutput(capture, buffer, got) == DIFFERENT) {
+                    result = DIVERGED;
+                    break;
+                }
+            } else if (got == 0 || errno != EINTR) {
+                close(outputFD);
+                outputFD = ERROR;
+            }
+        }
+
+        // Reap the child once it exits.
+        if (!exited && (pidFD == ERROR || events[pidIndex].revents)) {
+            pid_t reaped = wait4(pid, status, WNOHANG, usage);
+            if (reaped == pid) {
+                exited = 1;
+            } else if (reaped == ERROR && errno != EINTR) {
+                print("Error in: wait4\n");
+                result = ERROR;
+                break;
+            }
+        }
+
+    }
+
+    // Kill the child (and anything it forked) if it is stopped early, and reap it.
+    if (result != SUCCESS) {
+        kill(-pid, SIGKILL);
+    }
+    while (!exited && wait4(pid, status, 0, usage) == ERROR) {
+        if (errno != EINTR) {
+            print("Error in: wait4\n");
+            result = ERROR;
+            break;
+        }
+    }
+    if (pidFD != ERROR) {
+        close(pidFD);
+    }
+    if (outputFD != ERROR) {
+        close(outputFD);
+    }
+    return result;
+
+}
+
+/**********************************************************************************
+* Function:     releaseLaunch
+* Input:        A launch.
+* Output:       None.
+* Operation:    Closes the FDs the parent opened for the child.
+***********************************************************************************/
+void releaseLaunch(Launch *launch) {
+    int *fds[] = {&launch->fds[0], &launch->fds[1], &launch->fds[2], &launch->report[0], &launch->report[1]};
+    for (int i = 0; i < 5; ++i) {
+        if (*fds[i] != ERROR) {
+            close(*fds[i]);
+            *fds[i] = ERROR;
+        }
+    }
+}
+
+/**********************************************************************************
+* Function:     prepareLaunch
+* Input:        The launch to prepare, its command and limits (maybe NULL), a path
+*               for an input file (maybe NULL), and the write end of the output
+*               pipe (-1 to write the output to OUTPUT).
+* Output:       0 for success, -1 for error.
+* Operation:    Opens the files the child's input, output and errors are
+*               redirected to, and the pipe it reports a failure through. The
+*               launch owns the write end of the output pipe from now on.
+***********************************************************************************/
+int prepareLaunch(Launch *launch, char **command, const Limits *limits, const char *inputFile, int outputFD) {
+    *launch = (Launch){command, {ERROR, outputFD, ERROR}, limits, {ERROR, ERROR}, ERROR, ERROR, ERROR};
+    if (pipe2(launch->report, O_CLOEXEC) == ERROR) {
+        print("Error in: pipe\n");
+        return ERROR;
+    }
+    if ((inputFile != NULL && (launch->fds[0] = openRedirection(inputFile, 0)) == ERROR)
+        || (outputFD == ERROR && (launch->fds[1] = openRedirection(OUTPUT, 1)) == ERROR)
+        || (launch->fds[2] = openRedirection(ERRORS, 2)) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     launchChild
+* Input:        The launch (void * for clone()).
+* Output:       Never returns -- the child either executes the command or exits.
+* Operation:    Runs in the child between its start and execvp(). It leads a
+*               process group of its own (so a time-out kills whatever the command
+*               forks too), takes the FDs the parent opened as its input, output
+*               and errors, joins its memory cgroup, and sets its limits. Every other FD it inherited (the
+*               results, the trace, the manifest...) is marked close-on-exec, so
+*               the command can't write to them -- marked rather than closed, as
+*               the report pipe and the binary in memory are needed up to the
+*               execution itself. Only the binary the compiler writes stays open.
+*               A spawned child shares the memory of the parent, so it only makes
+*               system calls. A binary in memory is executed with fexecve(). If a
+*               step fails, its index and errno are written to the report pipe for
+*               the parent to print, rather than to the output of the child.
+***********************************************************************************/
+int launchChild(void *argument) {
+    Launch *launch = argument;
+    int failure[2] = {ERROR, 0};
+    setpgid(0, 0);
+    for (int i = 0; i < 3 && failure[0] == ERROR; ++i) {
+        if (launch->fds[i] != ERROR && dup2(launch->fds[i], i) == ERROR) {
+            failure[0] = 0;
+        }
+    }
+    if (syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) == ERROR) {
+        for (long fd = 3, last = sysconf(_SC_OPEN_MAX); fd < last; ++fd) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (launch->written != ERROR) {
+        fcntl(launch->written, F_SETFD, 0);
+    }
+    if (failure[0] == ERROR && launch->group != ERROR && write(launch->group, "0", 1) != 1) {
+        failure[0] = 3;
+    }
+    if (failure[0] == ERROR && launch->limits != NULL && applyLimits(launch->limits) == ERROR) {
+        failure[0] = 1;
+    }
+    if (failure[0] == ERROR) {
+        if (launch->program != ERROR) {
+            fexecve(launch->program, launch->command, environ);
+        } else {
+            execvp(launch->command[0], launch->command);
+        }
+        failure[0] = 2;
+    }
+    failure[1] = errno;
+    while (write(launch->report[1], failure, sizeof(failure)) == ERROR && errno == EINTR) {
+    }
+    _exit(EXIT_FAILURE);
+}
+
+/**********************************************************************************
+* Function:     startChild
+* Input:        A prepared launch.
+* Output:       The pid of the child, or -1 for error.
+* Operation:    Spawns the child with clone(CLONE_VM | CLONE_VFORK) -- it runs on
+*               a stack of its own in the memory of the parent, which waits until
+*               it executes the command, so nothing is copied however much memory
+*               the grader holds. posix_spawn() can't set resource limits, which is
+*               why it isn't used. With --launcher fork, or where clone() fails,
+*               the child is forked instead. Either way, a failure the child
+*               reports is printed and the child is reaped.
+***********************************************************************************/
+pid_t startChild(Launch *launch) {
+
+    // Spawn the child, or fork it.
+    pid_t pid = ERROR;
+    if (launcher == LAUNCH_SPAWN) {
+        pid = clone(launchChild, launchStack + LAUNCH_STACK, CLONE_VM | CLONE_VFORK | SIGCHLD, launch);
+    }
+    if (pid == ERROR) {
+        pid = fork();
+        if (pid == 0) {
+            launchChild(launch);
+        }
+    }
+    if (pid == ERROR) {
+        print("Error in: fork\n");
+        return ERROR;
+    }
+
+    // Read the report of the child -- its end of the pipe is closed on execvp(), so nothing means success.
+    close(launch->report[1]);
+    launch->report[1] = ERROR;
+    int failure[2];
+    ssize_t got;
+    while ((got = read(launch->report[0], failure, sizeof(failure))) == ERROR && errno == EINTR) {
+    }
+    if (got != sizeof(failure)) {
+        return pid;
+    }
+    char report[32];
+    snprintf(report, sizeof(report), "Error in: %s\n", launchSteps[failure[0]]);
+    print(report);
+    while (waitpid(pid, NULL, 0) == ERROR && errno == EINTR) {
+    }
+    return ERROR;
+
+}
+
+/**********************************************************************************
+* Function:     execute
+* Input:        Arguments for execvp(), a path for an input file (maybe NULL), a
+*               time limit in milliseconds (0 for none), resource limits (NULL
+*               for none), a pointer for the resource usage of the run (maybe
+*               NULL), and a capture to feed the output to (NULL to write the
+*               output to OUTPUT).
+* Output:       0 for success, -1 for error, 124 for time-out, 6 for an output
+*               that diverged, or 7, 8 or 9 for a broken limit (see
+*               limitVerdict()).
+* Operation:    Starts the given command in a child (see startChild()). Note that
+*               the parent opens the files of the IO redirection, the child only
+*               takes them over (see launchChild()), and the parent supervises
+*               the child (see superviseChild()).
+*               A compared output goes through a pipe and never touches the disk.
+***********************************************************************************/
+int execute(char **command, const char *inputFile, long timeLimit, const Limits *limits, Usage *usage,
+            Capture *capture) {
+
+    // Open a pipe for the output, if it is compared on the fly.
+    int output[2] = {ERROR, ERROR};
+    if (capture != NULL) {
+        if (pipe2(output, O_CLOEXEC) == ERROR) {
+            print("Error in: pipe\n");
+            return ERROR;
+        }
+        fcntl(output[0], F_SETPIPE_SZ, PIPE_SIZE);
+    }
+
+    // Run a program with a memory limit in the memory cgroup of this process, which enforces the limit
+    // instead of RLIMIT_DATA, and tells whether the program ran out of memory by the OOM kills it counts.
+    Limits grouped;
+    long oomKills = ERROR;
+    int group = ERROR;
+    if (limits != NULL && limits->memory && memoryGroups != NULL && (group = joinMemoryGroup(limits)) != ERROR) {
+        grouped = *limits;
+        grouped.memory = 0;
+        limits = &grouped;
+        oomKills = countOomKills();
+    }
+
+    // Redirect output to the pipe or to output.txt (temp) file, errors to errors.txt file, and input from the
+    // given inputFile (if given), then start the child.
+    Launch launch;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = ERROR;
+    if (prepareLaunch(&launch, command, limits, inputFile, output[1]) == SUCCESS) {
+        launch.program = binaryFD != ERROR && !strcmp(command[0], binaryPath) ? binaryFD : ERROR;
+        launch.written = launch.program == ERROR ? binaryFD : ERROR;
+        launch.group = group;
+        pid = startChild(&launch);
+    }
+
+    // The redirected files (and the write end of the pipe) belong to the child alone.
+    releaseLaunch(&launch);
+
+    // Parent supervising process.
+    if (pid > 0) {
+
+        // Set the group from this side as well, so it exists before a kill can be sent.
+        setpgid(pid, pid);
+
+        // Wait for the child to finish, or kill it once it is out of time or its output diverged.
+        int status;
+        struct rusage rusage;
+        int result = superviseChild(pid, &start, timeLimit, output[0], capture, &status, &rusage);
+        if (result == ERROR) {
+            return ERROR;
+        }
+
+        // Tell a broken limit from a crash.
+        if (result == SUCCESS && limits != NULL) {
+            result = limitVerdict(status, &rusage, limits, oomKills != ERROR && countOomKills() > oomKills);
+        }
+
+        // Keep the resources the child used.
+        if (usage != NULL) {
+            usage->userMs = rusage.ru_utime.tv_sec * 1000 + rusage.ru_utime.tv_usec / 1000;
+            usage->systemMs = rusage.ru_stime.tv_sec * 1000 + rusage.ru_stime.tv_usec / 1000;
+            usage->maxRssKb = rusage.ru_maxrss;
+            usage->wallMs = elapsedMs(&start);
+            usage->valid = 1;
+        }
+        return result;
+
+    }
+
+    // Case pid < 0 means the child didn't start (the reason is printed already) so return -1 for error.
+    if (output[0] != ERROR) {
+        close(output[0]);
+    }
+    return ERROR;
+
+}
+
+/**********************************************************************************
+* Function:     checkExtension
+* Input:        fileName - a string which represent a file name.
+* Output:       0 for success, 4 for failure
+* Operation:    Checks whether the name ends with ".c" or ".C" and return 0 for
+*               success. Otherwise, return 4 for failure.
+***********************************************************************************/
+int checkExtension(const char *fileName) {
+    size_t length = strlen(fileName);
+    if (length >= 2 && fileName[length - 2] == '.' && (fileName[length - 1] | 0x20) == 'c') {
+        return SUCCESS;
+    }
+    return FAILURE;
+}
+
+/**********************************************************************************
+* Function:     mergeFile
+* Input:        A file, the file to append it to, and whether to remove the first.
+* Output:       0 for success, -1 for error.
+* Operation:    Appends the content of a file (if exists) to another file, and
+*               removes the first if asked to. The parent merges the workers'
+*               files this way, so rows of different workers are never
+*               interleaved.
+***********************************************************************************/
+int mergeFile(const char *from, const char *to, int removeSource) {
+
+    // Nothing to merge if the worker never created the file.
+    int srcFD = open(from, O_RDONLY);
+    if (srcFD == ERROR) {
+        return SUCCESS;
+    }
+    int dstFD = open(to, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (dstFD == ERROR) {
+        print("Error in: open\n");
+        close(srcFD);
+        return ERROR;
+    }
+
+    // Copy the file in blocks.
+    char buffer[1 << 16];
+    ssize_t received;
+    int status = SUCCESS;
+    while ((received = read(srcFD, buffer, sizeof(buffer))) > 0) {
+        if (write(dstFD, buffer, received) != received) {
+            print("Error in: write\n");
+            status = ERROR;
+            break;
+        }
+    }
+    if (received == ERROR) {
+        print("Error in: read\n");
+        status = ERROR;
+    }
+    if (status == SUCCESS && syncResults && fsync(dstFD) == ERROR) {
+        print("Error in: fsync\n");
+        status = ERROR;
+    }
+    close(srcFD);
+    close(dstFD);
+    if (status == SUCCESS && removeSource && remove(from) != SUCCESS) {
+        print("Error in: remove\n");
+        return ERROR;
+    }
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     hashBytes
+* Input:        A running hash, bytes and their length.
+* Output:       The hash updated with the bytes.
+* Operation:    64 bit FNV-1a -- cheap, and plenty to tell submissions apart.
+***********************************************************************************/
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t length) {
+    const unsigned char *p = bytes;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**********************************************************************************
+* Function:     findCompilerIdentity
+* Input:        The compiler's name.
+* Output:       0 for success, -1 for error.
+* Operation:    Finds the compiler in PATH and describes it by its real path, size
+*               and modification time in compilerIdentity, so upgrading it changes
+*               every cache key.
+***********************************************************************************/
+int findCompilerIdentity(const char *compiler) {
+    const char *paths = getenv("PATH");
+    while (paths != NULL && *paths) {
+        size_t length = strcspn(paths, ":");
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%.*s/%s", (int)length, paths, compiler);
+        char *real = realpath(path, NULL);
+        struct stat compilerStat;
+        if (real != NULL && stat(real, &compilerStat) == SUCCESS && access(real, X_OK) == SUCCESS) {
+            snprintf(compilerIdentity, sizeof(compilerIdentity), "%s:%lld:%lld", real,
+                     (long long)compilerStat.st_size, (long long)compilerStat.st_mtime);
+            free(real);
+            return SUCCESS;
+        }
+        free(real);
+        paths += length + (paths[length] == ':');
+    }
+    print("Compiler not found\n");
+    return ERROR;
+}
+
+/**********************************************************************************
+* Function:     cacheKey
+* Input:        The compile command, the index of its source argument, and a
+*               buffer for the key.
+* Output:       0 for success, -1 for error.
+* Operation:    Hashes the compiler identity, the command without the source path
+*               and the bytes of the source, and writes the hash in hex. The
+*               binary is hashed as BINARY wherever it is, so --memfd shares keys.
+***********************************************************************************/
+int cacheKey(char **command, int sourceIndex, char key[17]) {
+
+    // Hash the compiler and its arguments.
+    uint64_t hash = hashBytes(FNV_OFFSET, compilerIdentity, strlen(compilerIdentity) + 1);
+    for (int i = 0; command[i] != NULL; ++i) {
+        const char *argument = !strcmp(command[i], binaryPath) ? BINARY : command[i];
+        if (i != sourceIndex) {
+            hash = hashBytes(hash, argument, strlen(argument) + 1);
+        }
+    }
+
+    // Hash the source.
+    int fd = open(command[sourceIndex], O_RDONLY);
+    if (fd == ERROR) {
+        print("Error in: open\n");
+        return ERROR;
+    }
+    char buffer[1 << 16];
+    ssize_t received;
+    while ((received = read(fd, buffer, sizeof(buffer))) > 0) {
+        hash = hashBytes(hash, buffer, received);
+    }
+    close(fd);
+    if (received == ERROR) {
+        print("Error in: read\n");
+        return ERROR;
+    }
+    snprintf(key, 17, "%016llx", (unsigned long long)hash);
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     copyFile
+* Input:        Source path, destination path, destination's mode, and an offset
+*               to start copying from.
+* Output:       0 for success, -1 for error.
+* Operation:    Copies a file from the given offset. The destination is written to
+*               a temporary name and renamed, so readers never see half of it.
+***********************************************************************************/
+int copyFile(const char *from, const char *to, mode_t mode, off_t offset) {
+
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", to, (int)getpid());
+    int srcFD = open(from, O_RDONLY);
+    if (srcFD == ERROR) {
+        return ERROR;
+    }
+    int dstFD = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (dstFD == ERROR) {
+        close(srcFD);
+        return ERROR;
+    }
+    char buffer[1 << 16];
+    ssize_t received;
+    int status = lseek(srcFD, offset, SEEK_SET) == ERROR ? ERROR : SUCCESS;
+    while (status == SUCCESS && (received = read(srcFD, buffer, sizeof(buffer))) != 0) {
+        if (received == ERROR || write(dstFD, buffer, received) != received) {
+            status = ERROR;
+        }
+    }
+    close(srcFD);
+    if (close(dstFD) == ERROR || status == ERROR || rename(temporary, to) == ERROR) {
+        unlink(temporary);
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     createBinary
+* Input:        None.
+* Output:       0 for success, -1 for error.
+* Operation:    With --memfd, creates the memory file the compiler writes the
+*               binary to, through its /proc/self/fd path. The FD is inherited by
+*               the compiler (and the linker it runs), so that path opens it in
+*               their processes too. Without --memfd, the binary is BINARY.
+***********************************************************************************/
+int createBinary(void) {
+    if (!diskless) {
+        return SUCCESS;
+    }
+    binaryFD = memfd_create("b.out", 0);
+    if (binaryFD == ERROR) {
+        print("Error in: memfd_create\n");
+        return ERROR;
+    }
+    snprintf(binaryPath, sizeof(binaryPath), "/proc/self/fd/%d", binaryFD);
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     binaryExists
+* Input:        None.
+* Output:       1 if the compilation made a binary, 0 otherwise.
+* Operation:    Checks BINARY exists, or that the binary in memory isn't empty.
+***********************************************************************************/
+int binaryExists(void) {
+    struct stat binaryStat;
+    if (!diskless) {
+        return access(BINARY, F_OK) == SUCCESS;
+    }
+    return binaryFD != ERROR && fstat(binaryFD, &binaryStat) == SUCCESS && binaryStat.st_size > 0;
+}
+
+/**********************************************************************************
+* Function:     loadBinary
+* Input:        The path of a binary.
+* Output:       0 for success, -1 for error.
+* Operation:    Copies the binary into the binary in memory.
+***********************************************************************************/
+int loadBinary(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+    struct stat binaryStat;
+    int status = fstat(fd, &binaryStat) == SUCCESS && ftruncate(binaryFD, 0) == SUCCESS ? SUCCESS : ERROR;
+    for (off_t done = 0; status == SUCCESS && done < binaryStat.st_size;) {
+        ssize_t copied = sendfile(binaryFD, fd, NULL, binaryStat.st_size - done);
+        if (copied <= 0) {
+            status = ERROR;
+        }
+        done += copied;
+    }
+    close(fd);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     sealBinary
+* Input:        None.
+* Output:       0 for success, -1 for error.
+* Operation:    With --memfd, swaps the writable FD of the binary in memory for a
+*               read-only one, as a file that is open for writing can't be
+*               executed (ETXTBSY).
+***********************************************************************************/
+int sealBinary(void) {
+    if (!diskless) {
+        return SUCCESS;
+    }
+    int readOnly = open(binaryPath, O_RDONLY | O_CLOEXEC);
+    if (readOnly == ERROR) {
+        print("Error in: open\n");
+        return ERROR;
+    }
+    close(binaryFD);
+    binaryFD = readOnly;
+    snprintf(binaryPath, sizeof(binaryPath), "/proc/self/fd/%d", binaryFD);
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     removeBinary
+* Input:        None.
+* Output:       0 for success, -1 for error.
+* Operation:    Removes BINARY, or closes the binary in memory.
+***********************************************************************************/
+int removeBinary(void) {
+    if (!diskless) {
+        return safeRemove(BINARY);
+    }
+    if (binaryFD != ERROR) {
+        close(binaryFD);
+        binaryFD = ERROR;
+    }
+    strcpy(binaryPath, BINARY);
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     fetchFromCache
+* Input:        A cache key.
+* Output:       1 for a hit, 0 for a miss.
+* Operation:    On a cached binary, links (or copies) it to BINARY, or copies it
+*               into the binary in memory (see --memfd). On a cached
+*               compilation error, appends the stored compiler errors to ERRORS
+*               and leaves BINARY missing, just like a failing compilation. Either
+*               way, the entry's modification time is refreshed for LRU eviction.
+***********************************************************************************/
+int fetchFromCache(const char *key) {
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.bin", cacheDirectory, key);
+    if (access(path, F_OK) == SUCCESS) {
+        if (diskless ? loadBinary(path) == ERROR
+                     : link(path, BINARY) == ERROR && copyFile(path, BINARY, S_IRWXU, 0) == ERROR) {
+            return 0;
+        }
+        utimensat(AT_FDCWD, path, NULL, 0);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.err", cacheDirectory, key);
+    if (access(path, F_OK) == SUCCESS) {
+        if (mergeFile(path, ERRORS, 0) == ERROR) {
+            return 0;
+        }
+        utimensat(AT_FDCWD, path, NULL, 0);
+        return 1;
+    }
+    return 0;
+
+}
+
+/**********************************************************************************
+* Function:     storeInCache
+* Input:        A cache key, and the size ERRORS had before compiling.
+* Output:       None -- a failure to cache only costs a future compilation.
+* Operation:    Stores BINARY if the compilation made one, or else the errors the
+*               compiler appended to ERRORS.
+***********************************************************************************/
+void storeInCache(const char *key, off_t errorsOffset) {
+    char path[PATH_MAX];
+    if (binaryExists()) {
+        snprintf(path, sizeof(path), "%s/%s.bin", cacheDirectory, key);
+        copyFile(binaryPath, path, S_IRWXU, 0);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s.err", cacheDirectory, key);
+        copyFile(ERRORS, path, S_IRUSR | S_IWUSR, errorsOffset);
+    }
+}
+
+/**********************************************************************************
+* Function:     compile
+* Input:        The compile command, and the index of its source argument.
+* Output:       The result of execute() -- 0 for success, -1 for error.
+* Operation:    Compiles the source with execute(), or if the compilation cache is
+*               enabled (-c), takes its result from the cache when the same source
+*               was already compiled by the same compiler with the same arguments.
+*               Either way, success with no BINARY means a compilation error.
+***********************************************************************************/
+int compile(char **command, int sourceIndex) {
+
+    // No cache, or a source that cannot be hashed -- just compile.
+    char key[17];
+    if (cacheDirectory == NULL || cacheKey(command, sourceIndex, key) == ERROR) {
+        return execute(command, NULL, 0, NULL, NULL, NULL);
+    }
+
+    // A hit.
+    if (fetchFromCache(key)) {
+        __atomic_fetch_add(&shared->cacheHits, 1, __ATOMIC_RELAXED);
+        return SUCCESS;
+    }
+
+    // A miss -- compile and store the result.
+    __atomic_fetch_add(&shared->cacheMisses, 1, __ATOMIC_RELAXED);
+    struct stat errorsStat;
+    off_t errorsOffset = stat(ERRORS, &errorsStat) == SUCCESS ? errorsStat.st_size : 0;
+    int status = execute(command, NULL, 0, NULL, NULL, NULL);
+    if (status == SUCCESS) {
+        storeInCache(key, errorsOffset);
+    }
+    return status;
+
+}
+
+/**********************************************************************************
+* Struct:       CacheEntry
+* Operation:    A file of the compilation cache, as listed by evictCache().
+***********************************************************************************/
+typedef struct {
+    char name[NAME_MAX + 1];
+    off_t size;
+    time_t used;
+} CacheEntry;
+
+/**********************************************************************************
+* Function:     compareCacheEntries
+* Input:        Two CacheEntry pointers (qsort() style).
+* Output:       Negative, zero or positive, by the entries' last use.
+* Operation:    Orders cache entries from the least recently used.
+***********************************************************************************/
+int compareCacheEntries(const void *a, const void *b) {
+    time_t x = ((const CacheEntry *)a)->used, y = ((const CacheEntry *)b)->used;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************************************
+* Function:     evictCache
+* Input:        None.
+* Output:       None.
+* Operation:    Keeps the compilation cache within cacheLimit bytes by removing the
+*               least recently used entries (oldest modification time) first.
+***********************************************************************************/
+void evictCache(void) {
+
+    DIR *dir = opendir(cacheDirectory);
+    if (!dir) {
+        return;
+    }
+
+    // List the entries with their sizes and times.
+    CacheEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    off_t total = 0;
+    struct dirent *dirEnt;
+    while ((dirEnt = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        struct stat entryStat;
+        snprintf(path, sizeof(path), "%s/%s", cacheDirectory, dirEnt->d_name);
+        if (stat(path, &entryStat) == ERROR || !S_ISREG(entryStat.st_mode)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            CacheEntry *grown = realloc(entries, capacity * sizeof(CacheEntry));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+        strcpy(entries[count].name, dirEnt->d_name);
+        entries[count].size = entryStat.st_size;
+        entries[count].used = entryStat.st_mtime;
+        total += entryStat.st_size;
+        ++count;
+    }
+    closedir(dir);
+
+    // Remove the least recently used entries until the cache fits.
+    qsort(entries, count, sizeof(CacheEntry), compareCacheEntries);
+    for (size_t i = 0; i < count && total > cacheLimit; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", cacheDirectory, entries[i].name);
+        if (unlink(path) == SUCCESS) {
+            total -= entries[i].size;
+        }
+    }
+    free(entries);
+
+}
+
+/**********************************************************************************
+* Function:     findAndCompile
+* Input:        The submission and the path to its directory.
+* Output:       0 for success, 4 for failure, -1 for significant error.
+* Operation:    Compiles the C file collectSubmissions() found in the submission's
+*               directory with execute() (through compile()). It also uses
+*               writeResult() function to .. write to CSV when needed.
+***********************************************************************************/
+int findAndCompile(const Submission *submission, const char *directoryPath) {
+
+    // Handle case C file not found.
+    if (submission->source == NULL) {
+        if (writeResult(submission->name, "0" ,"NO_C_FILE") == ERROR) {
+            return ERROR;
+        }
+        return FAILURE;
+    }
+
+    // Creates a path to the C file, and create arguments for execute() function.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directoryPath, submission->source);
+    if (createBinary() == ERROR) {
+        return ERROR;
+    }
+    char *command[] = {COMPILER, "-o", binaryPath, path, NULL};
+
+    // Compile the C file using compile() function (through the cache, if enabled). If the execution was a
+    // success and the binary file exists, it is ready to run. Otherwise (also in the edge-case where the
+    // compiler didn't create the binary file for some reason) relate as compilation error.
+    if (compile(command, 3) == SUCCESS && binaryExists()) {
+        return sealBinary();
+    }
+    if (writeResult(submission->name, "10" ,"COMPILATION_ERROR") == ERROR) {
+        return ERROR;
+    }
+    return FAILURE;
+
+}
+
+/**********************************************************************************
+* Function:     findVerdict
+* Input:        A status, or a reason (NULL to look the status up).
+* Output:       The verdict of the status or the reason, or NULL if none has it.
+* Operation:    Looks the status or the reason up in verdicts.
+***********************************************************************************/
+const Verdict *findVerdict(int status, const char *reason) {
+    for (size_t i = 0; i < sizeof(verdicts) / sizeof(Verdict); ++i) {
+        if (reason != NULL ? !strcmp(verdicts[i].reason, reason) : verdicts[i].status == status) {
+            return &verdicts[i];
+        }
+    }
+    return NULL;
+}
+
+/**********************************************************************************
+* Function:     keepOutput
+* Input:        A held back output (see Capture).
+* Output:       The hash of the output, or 0 if it couldn't be kept.
+* Operation:    Keeps the output in the state directory under its hash (once for
+*               all the submissions that printed it), so the next
+*               incremental run can compare it to a fixed correct output without
+*               running the program again. It is written to a temporary file and
+*               renamed, so a worker never reads a half written output.
+***********************************************************************************/
+uint64_t keepOutput(const Capture *capture) {
+    uint64_t hash = hashOutput(capture->pending, capture->length);
+    char path[PATH_MAX], temporary[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s" KEPT_OUTPUTS "/%016lx", stateDirectory, (unsigned long)hash);
+    if (hash == 0 || access(path, F_OK) == SUCCESS) {
+        return hash;
+    }
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == ERROR) {
+        return 0;
+    }
+    int kept = write(fd, capture->pending, capture->length) == (ssize_t)capture->length;
+    kept = close(fd) == SUCCESS && kept && rename(temporary, path) == SUCCESS;
+    if (!kept) {
+        unlink(temporary);
+    }
+    return kept ? hash : 0;
+}
+
+/**********************************************************************************
+* Function:     runProgram
+* Input:        Path to input file, and the capture to feed the output to.
+* Output:       Return 0 for success, -1 for error, 124 for time-out, or 6 if the
+*               output diverged from the correct output.
+* Operation:    This function creates the arguments to run the compiled program in
+*               the current sub-directory (if found and successfully compiled).
+*               then it run it for up to the time limit of the capture's case (in
+*               milliseconds) and return status.
+*               The usage of the run is added to lastUsage -- CPU and wall times
+*               are summed over the test cases, and the max RSS is their maximum.
+***********************************************************************************/
+int runProgram(const char *inputFile, Capture *capture) {
+
+    // Create command for execvp() (or fexecve(), for a binary in memory).
+    char *command[] = {binaryPath, NULL};
+
+    // Run program using execute() function (that uses fork() and execvp()), and keep its usage.
+    Usage usage = {0};
+    int status = execute(command, inputFile, capture->testCase->timeLimit, &limits, &usage, capture);
+    if (usage.valid) {
+        lastUsage.userMs += usage.userMs;
+        lastUsage.systemMs += usage.systemMs;
+        lastUsage.wallMs += usage.wallMs;
+        if (usage.maxRssKb > lastUsage.maxRssKb) {
+            lastUsage.maxRssKb = usage.maxRssKb;
+        }
+        lastUsage.valid = 1;
+    }
+
+    // Return 0 for success, -1 for error, 124 for time-out, 6 for a diverged output and 7-9 for a broken limit.
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     runCase
+* Input:        A test case, and pointers for the case's grade and reason and for
+*               the hash of its kept output.
+* Output:       0 for success, -1 for error.
+* Operation:    Runs the compiled program on the case's input and grades its
+*               output -- TIMEOUT, WRONG, SIMILAR or EXCELLENT, or MEMORY_LIMIT,
+*               CPU_LIMIT or FILE_LIMIT for a program that broke a limit, so it
+*               isn't misread as a WRONG answer. An output that was graded before
+*               takes its verdict from the output cache, and a new one is compared
+*               once the program is done -- or while the program writes it, when
+*               it is long or slow, so a program whose output is already WRONG
+*               (or too long) is killed right away. An incremental run keeps the
+*               held back output of a program that ran to its end (see
+*               keepOutput()), and sets output to its hash (0 otherwise).
+***********************************************************************************/
+int runCase(const TestCase *testCase, int *grade, const char **reason, uint64_t *output) {
+
+    // Run the program, and compare its output to the correct output (or look it up).
+    Capture capture;
+    if (beginCapture(&capture, testCase) == ERROR) {
+        print("Error in: malloc\n");
+        return ERROR;
+    }
+    long begin = traceNow();
+    int status = runProgram(testCase->input, &capture);
+    traceEvent("run", begin);
+    begin = traceNow();
+    *output = status == SUCCESS && stateDirectory != NULL && !capture.streaming ? keepOutput(&capture) : 0;
+    int verdict = endCapture(&capture);
+    traceEvent("compare", begin);
+    if (status == DIVERGED) {
+        status = DIFFERENT;
+    } else if (status == SUCCESS) {
+        status = verdict;
+    }
+    const Verdict *found = findVerdict(status, NULL);
+    if (found == NULL || status == FAILURE) {
+        return ERROR;
+    }
+    *grade = found->grade;
+    *reason = found->reason;
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Struct:       Entries
+* Operation:    A directory being listed -- its FD, and the entries the last call
+*               to getdents64() read into buffer (length bytes, of which offset
+*               were used already). length is -1 if reading them failed.
+***********************************************************************************/
+typedef struct {
+    int fd;
+    long length;
+    long offset;
+    _Alignas(struct dirent64) char buffer[ENTRIES_BUFFER];
+} Entries;
+
+/**********************************************************************************
+* Function:     nextEntry
+* Input:        The directory being listed.
+* Output:       Its next entry, or NULL at its end (or if reading it failed).
+* Operation:    Hands out the entries of the directory one by one, reading them
+*               ENTRIES_BUFFER bytes at a time, so a large directory takes a few
+*               system calls (and round-trips, on a network mount) to list.
+***********************************************************************************/
+struct dirent64 *nextEntry(Entries *entries) {
+    if (entries->offset >= entries->length) {
+        entries->length = getdents64(entries->fd, entries->buffer, sizeof(entries->buffer));
+        entries->offset = 0;
+        if (entries->length <= 0) {
+            return NULL;
+        }
+    }
+    struct dirent64 *entry = (struct dirent64 *)(entries->buffer + entries->offset);
+    entries->offset += entry->d_reclen;
+    return entry;
+}
+
+/**********************************************************************************
+* Function:     isDirectory
+* Input:        The FD of a directory, and one of its entries.
+* Output:       1 if the entry is a directory (or a link to one), 0 if not, -1 for
+*               error.
+* Operation:    Trusts the type getdents64() gave the entry, and only asks for its
+*               stat (with fstatat()) when the file system didn't give one, or
+*               the entry is a link to be followed.
+***********************************************************************************/
+int isDirectory(int dirFD, const struct dirent64 *entry) {
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+        return entry->d_type == DT_DIR;
+    }
+    struct stat pathStat;
+    if (fstatat(dirFD, entry->d_name, &pathStat, 0) == ERROR) {
+        return ERROR;
+    }
+    return S_ISDIR(pathStat.st_mode) ? 1 : 0;
+}
+
+/**********************************************************************************
+* Function:     findSource
+* Input:        The FD of the target directory, and a submission.
+* Output:       0 for success, -1 for error.
+* Operation:    Lists the directory of the submission and keeps the name of the
+*               first file that passes checkExtension() as its source (which
+*               stays NULL if none does).
+***********************************************************************************/
+int findSource(int targetFD, Submission *submission) {
+
+    // Open the submission's directory.
+    Entries entries;
+    entries.length = entries.offset = 0;
+    if ((entries.fd = openat(targetFD, submission->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == ERROR) {
+        print("Error in: openat\n");
+        return ERROR;
+    }
+
+    // Look for the C file.
+    struct dirent64 *entry;
+    while ((entry = nextEntry(&entries)) != NULL) {
+        if (checkExtension(entry->d_name) == SUCCESS) {
+            if ((submission->source = strdup(entry->d_name)) == NULL) {
+                print("Error in: strdup\n");
+                close(entries.fd);
+                return ERROR;
+            }
+            break;
+        }
+    }
+    close(entries.fd);
+    if (entries.length == ERROR) {
+        print("Error in: getdents64\n");
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     collectSubmissions
+* Input:        Target directory, pointers for the submissions array and its size,
+*               and whether to look for the sources of the submissions.
+* Output:       0 for success, -1 for error.
+* Operation:    Lists the sub-directories of the target directory -- one for each
+*               submission -- so they can be handed out to the workers, and (if
+*               asked to) the C file of each, so the workers don't list them
+*               again. Everything is read through directory FDs, so no path is
+*               looked up twice. When sharded, only the names whose hash falls in
+*               this shard are kept, so every host of a sharded run agrees on the
+*               partition no matter the order getdents64() returns. The caller
+*               releases the submissions with releaseSubmissions().
+***********************************************************************************/
+int collectSubmissions(const char *target, Submission **submissions, int *count, int withSources) {
+
+    *submissions = NULL;
+    *count = 0;
+
+    // Try to open the target directory.
+    Entries *entries = malloc(sizeof(Entries));
+    if (entries == NULL) {
+        print("Error in: malloc\n");
+        return ERROR;
+    }
+    entries->length = entries->offset = 0;
+    if ((entries->fd = open(target, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == ERROR) {
+        print("Not a valid directory\n");
+        free(entries);
+        return ERROR;
+    }
+
+    // Traverse sub-directories and collect them.
+    int capacity = 0, status = SUCCESS;
+    struct dirent64 *entry;
+    while (status == SUCCESS && (entry = nextEntry(entries)) != NULL) {
+
+        // Save directory name in a variable for convenience reason.
+        const char *name = entry->d_name;
+
+        // Avoid current and previous directories references.
+        if (!strcmp(name, ".") || !strcmp(name, "..")) {
+            continue;
+        }
+
+        // Leave the names of other shards to them.
+        if (hashBytes(FNV_OFFSET, name, strlen(name)) % shardCount != (uint64_t)shardIndex) {
+            continue;
+        }
+
+        // Engage only directories.
+        int directory = isDirectory(entries->fd, entry);
+        if (directory != 1) {
+            status = directory;
+            continue;
+        }
+
+        // Keep the submission, doubling the array whenever it fills up.
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            Submission *grown = realloc(*submissions, capacity * sizeof(Submission));
+            if (grown == NULL) {
+                print("Error in: realloc\n");
+                status = ERROR;
+                continue;
+            }
+            *submissions = grown;
+        }
+        Submission *submission = &(*submissions)[*count];
+        submission->source = NULL;
+        if ((submission->name = strdup(name)) == NULL) {
+            print("Error in: strdup\n");
+            status = ERROR;
+            continue;
+        }
+        ++*count;
+        if (withSources) {
+            status = findSource(entries->fd, submission);
+        }
+
+    }
+    if (entries->length == ERROR) {
+        print("Error in: getdents64\n");
+        status = ERROR;
+    }
+
+    // Close target directory.
+    if (close(entries->fd) == ERROR) {
+        print("Error in: close\n");
+        status = ERROR;
+    }
+    free(entries);
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     releaseSubmissions
+* Input:        The submissions array and its size.
+* Output:       None.
+* Operation:    Releases the submissions collected by collectSubmissions().
+***********************************************************************************/
+void releaseSubmissions(Submission *submissions, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(submissions[i].name);
+        free(submissions[i].source);
+    }
+    free(submissions);
+}
+
+/**********************************************************************************
+* Function:     hashFile
+* Input:        A path, and a running hash.
+* Output:       The hash updated with the content of the file, or 0 if it can't be
+*               read.
+* Operation:    Reads the file in chunks into the hash (see hashBytes()).
+***********************************************************************************/
+uint64_t hashFile(const char *path, uint64_t hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return 0;
+    }
+    char buffer[1 << 16];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+        hash = hashBytes(hash, buffer, got);
+    }
+    close(fd);
+    return got == 0 ? hash : 0;
+}
+
+/**********************************************************************************
+* Function:     compareNames
+* Input:        Two string pointers (qsort() style).
+* Output:       Negative, zero or positive, by the strings.
+* Operation:    Orders names alphabetically.
+***********************************************************************************/
+int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**********************************************************************************
+* Function:     hashSubmission
+* Input:        The path of a submission's directory.
+* Output:       The hash of the submission's files, or 0 if they can't be read.
+* Operation:    Hashes the name and content of every file of the directory, in
+*               order of name, so a submission whose files didn't change gets the
+*               same hash however getdents64() lists them.
+***********************************************************************************/
+uint64_t hashSubmission(const char *directoryPath) {
+
+    // List the files.
+    Entries *entries = malloc(sizeof(Entries));
+    if (entries == NULL) {
+        return 0;
+    }
+    entries->length = entries->offset = 0;
+    if ((entries->fd = open(directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == ERROR) {
+        free(entries);
+        return 0;
+    }
+    char **files = NULL;
+    int count = 0;
+    struct dirent64 *entry;
+    while ((entry = nextEntry(entries)) != NULL) {
+        if (entry->d_name[0] == '.' || (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)) {
+            continue;
+        }
+        char **grown = realloc(files, (count + 1) * sizeof(char *));
+        if (grown == NULL || (grown[count] = strdup(entry->d_name)) == NULL) {
+            files = grown != NULL ? grown : files;
+            count = -count - 1;
+            break;
+        }
+        files = grown;
+        ++count;
+    }
+    if (entries->length == ERROR && count >= 0) {
+        count = -count - 1;
+    }
+    close(entries->fd);
+    free(entries);
+
+    // Hash them in order.
+    uint64_t hash = count < 0 ? 0 : FNV_OFFSET;
+    count = count < 0 ? -count - 1 : count;
+    qsort(files, count, sizeof(char *), compareNames);
+    char path[PATH_MAX];
+    for (int i = 0; i < count; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", directoryPath, files[i]);
+        if (hash != 0) {
+            hash = hashFile(path, hashBytes(hash, files[i], strlen(files[i]) + 1));
+        }
+        free(files[i]);
+    }
+    free(files);
+    return hash;
+
+}
+
+/**********************************************************************************
+* Function:     parseManifestEntry
+* Input:        A line of the manifest (changed in place), and the entry to fill.
+* Output:       0 for success, -1 for a line that can't be used.
+* Operation:    Splits the line to its tab-separated fields (see
+*               recordSubmission()). The strings of the entry point into the line.
+***********************************************************************************/
+int parseManifestEntry(char *line, ManifestEntry *entry) {
+
+    // The submission.
+    char *fields[5], *next = line;
+    for (int i = 0; i < 5; ++i) {
+        fields[i] = strsep(&next, "\t");
+        if (fields[i] == NULL) {
+            return ERROR;
+        }
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->name = fields[0];
+    entry->source = strtoull(fields[1], NULL, 16);
+    entry->grade = fields[2];
+    entry->reason = fields[3];
+    if (sscanf(fields[4], "%ld,%ld,%ld,%ld,%d", &entry->usage.userMs, &entry->usage.systemMs,
+               &entry->usage.maxRssKb, &entry->usage.wallMs, &entry->usage.valid) != 5) {
+        return ERROR;
+    }
+    if (next == NULL) {
+        return SUCCESS;
+    }
+
+    // Its cases -- one for each case of this run, or the entry can't be used.
+    entry->reasons = calloc(caseTotal, sizeof(char *));
+    entry->outputs = calloc(caseTotal, sizeof(uint64_t));
+    int count = 0;
+    for (char *field; entry->reasons != NULL && entry->outputs != NULL && (field = strsep(&next, "\t")) != NULL;
+         ++count) {
+        char *colon = strrchr(field, ':');
+        const Verdict *verdict = NULL;
+        if (colon != NULL) {
+            *colon = '\0';
+            verdict = findVerdict(0, field);
+        }
+        if (count == caseTotal || verdict == NULL) {
+            break;
+        }
+        entry->reasons[count] = verdict->reason;
+        entry->outputs[count] = strtoull(colon + 1, NULL, 16);
+    }
+    if (count != caseTotal || next != NULL) {
+        free(entry->reasons);
+        free(entry->outputs);
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     loadManifest
+* Input:        The test cases, and their number.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads the manifest of the last run (if any) into manifestEntries,
+*               sorted by name, and marks every case whose input or correct
+*               output changed since. A manifest of other settings (limits,
+*               compiler, options that change grades) or of another number of
+*               cases is ignored, so every submission is regraded.
+***********************************************************************************/
+int loadManifest(TestCase *cases, int count) {
+
+    // Read the whole manifest, if there is one.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s" MANIFEST, stateDirectory);
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return errno == ENOENT ? SUCCESS : ERROR;
+    }
+    struct stat manifestStat;
+    if (fstat(fd, &manifestStat) == ERROR) {
+        print("Error in: fstat\n");
+        close(fd);
+        return ERROR;
+    }
+    char *content = malloc(manifestStat.st_size + 1);
+    ssize_t received = ERROR;
+    if (content != NULL) {
+        received = read(fd, content, manifestStat.st_size);
+    }
+    close(fd);
+    if (received != manifestStat.st_size) {
+        print("Error in: read\n");
+        free(content);
+        return ERROR;
+    }
+    content[received] = '\0';
+
+    // Check the header -- the settings, then the hashes of the input and correct output of every case.
+    char *next = content, *line = strsep(&next, "\n");
+    char header[64];
+    snprintf(header, sizeof(header), MANIFEST_MAGIC "\t%016lx\t%d", (unsigned long)manifestSettings, count);
+    size_t length = strlen(header);
+    if (strncmp(line, header, length) != SUCCESS || (line[length] != '\t' && line[length] != '\0')) {
+        free(content);
+        return SUCCESS;
+    }
+    line += length;
+    for (int i = 0; i < count; ++i) {
+        unsigned long input = 0, correct = 0;
+        if (line != NULL && sscanf(line, "\t%lx:%lx", &input, &correct) == 2) {
+            line = strchr(line + 1, '\t');
+        }
+        cases[i].changes = (input != cases[i].inputHash ? INPUT_CHANGED : 0)
+                           | (correct != cases[i].correctHash ? EXPECTED_CHANGED : 0);
+    }
+
+    // Parse the submissions, and sort them by name.
+    ManifestEntry *entries = NULL;
+    int entryCount = 0, capacity = 0;
+    while ((line = strsep(&next, "\n")) != NULL) {
+        if (entryCount == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            ManifestEntry *grown = realloc(entries, capacity * sizeof(ManifestEntry));
+            if (grown == NULL) {
+                print("Error in: realloc\n");
+                free(entries);
+                free(content);
+                return ERROR;
+            }
+            entries = grown;
+        }
+        if (parseManifestEntry(line, &entries[entryCount]) == SUCCESS) {
+            ++entryCount;
+        }
+    }
+    qsort(entries, entryCount, sizeof(ManifestEntry), compareNames);
+    manifestEntries = entries;
+    manifestCount = entryCount;
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     reuseSubmission
+* Input:        The path of a submission's directory, its name, the test cases and
+*               their number.
+* Output:       0 if the submission was graded from the manifest, 4 if it has to
+*               be regraded, -1 for error.
+* Operation:    A submission whose files didn't change keeps the grade of the last
+*               run, as long as every case it ran can keep its verdict too: a
+*               case of an unchanged input and correct output keeps it, and a case
+*               whose correct output alone changed is graded by comparing the
+*               output the program printed last time (if it was kept) to the new
+*               correct output. With -f, a changed verdict can change which cases
+*               run, so only the first kind is kept. The grade is then written as
+*               if the submission ran again.
+***********************************************************************************/
+int reuseSubmission(const char *path, const char *name, const TestCase *cases, int count) {
+
+    // Find the submission in the manifest, and check its files.
+    currentSource = hashSubmission(path);
+    const ManifestEntry key = {.name = (char *)name};
+    const ManifestEntry *entry = bsearch(&key, manifestEntries, manifestCount, sizeof(ManifestEntry),
+                                         compareNames);
+    if (entry == NULL || currentSource == 0 || entry->source != currentSource) {
+        return FAILURE;
+    }
+
+    // A submission that didn't run doesn't depend on the cases.
+    lastUsage = entry->usage;
+    if (entry->reasons == NULL) {
+        return writeResult(name, entry->grade, entry->reason) == ERROR ? ERROR : SUCCESS;
+    }
+
+    // Take the verdict of every case, from the manifest or by comparing the kept output.
+    int total = 0, worst = 100;
+    const char *worstReason = "EXCELLENT";
+    for (int i = 0; i < count; ++i) {
+        const Verdict *verdict = findVerdict(0, entry->reasons[i]);
+        if (cases[i].changes & INPUT_CHANGED || (cases[i].changes && (failFast || entry->outputs[i] == 0))) {
+            return FAILURE;
+        }
+        if (cases[i].changes & EXPECTED_CHANGED) {
+            char outputPath[PATH_MAX];
+            snprintf(outputPath, sizeof(outputPath), "%s" KEPT_OUTPUTS "/%016lx", stateDirectory,
+                     (unsigned long)entry->outputs[i]);
+            int fd = open(outputPath, O_RDONLY);
+            if (fd == ERROR) {
+                return FAILURE;
+            }
+            verdict = findVerdict(compareToReference(fd, &cases[i].correctOutput), NULL);
+            close(fd);
+            if (verdict == NULL) {
+                return FAILURE;
+            }
+        }
+        if (verdict->grade < worst) {
+            worst = verdict->grade;
+            worstReason = verdict->reason;
+        }
+        total += verdict->grade;
+        caseReasons[i] = verdict->reason;
+        caseOutputs[i] = entry->outputs[i];
+    }
+    char grade[12];
+    snprintf(grade, sizeof(grade), "%d", total / count);
+    return writeResult(name, grade, worstReason) == ERROR ? ERROR : SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     gradeSubmission
+* Input:        Target directory, the submission, and the test cases.
+* Output:       0 for success, -1 for failure.
+* Operation:    Grades a single submission. It does 3 things:
+*                   1) Compile its C file (with findAndCompile()).
+*                   2) Try to run the binary on the input of every test case,
+*                      within the time limit of the case (with runCase()).
+*                   3) Compare each output with the correct one (with runCase()).
+*               The grade is the average grade of the cases, and the reason is the
+*               reason of the worst case. With more than one case, the verdict of
+*               each case is written as an extra column. With -f, the cases after
+*               the first WRONG, TIMEOUT or broken limit are SKIPPED, and get 0.
+*               An incremental run first tries to keep the grade of the last run
+*               (see reuseSubmission()).
+*               Each and every operation is checked, and the function returns -1
+*               if any significant error occured.
+***********************************************************************************/
+int gradeSubmission(const char *target, const Submission *submission, const TestCase *cases, int count) {
+
+    // Create a path to the submission's directory.
+    const char *name = submission->name;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", target, name);
+
+    // Forget the usage and the case verdicts of the previous submission.
+    memset(&lastUsage, 0, sizeof(lastUsage));
+    memset(caseReasons, 0, count * sizeof(char *));
+    memset(caseOutputs, 0, count * sizeof(uint64_t));
+
+    // Keep the grade of the last run, if nothing it depends on changed (incremental runs only).
+    if (stateDirectory != NULL) {
+        int reused = reuseSubmission(path, name, cases, count);
+        if (reused != FAILURE) {
+            __atomic_fetch_add(&shared->reused, reused == SUCCESS, __ATOMIC_RELAXED);
+            return reused;
+        }
+        __atomic_fetch_add(&shared->regraded, 1, __ATOMIC_RELAXED);
+        memset(&lastUsage, 0, sizeof(lastUsage));
+        memset(caseReasons, 0, count * sizeof(char *));
+        memset(caseOutputs, 0, count * sizeof(uint64_t));
+    }
+
+    // Compile the C file of the sub-directory. Return Error (-1) if needed.
+    long begin = traceNow();
+    int status = findAndCompile(submission, path);
+    traceEvent("compile", begin);
+    if (status == ERROR) {
+        return ERROR;
+    }
+
+    // If a C file was found and successfully compiled, run it on every test case.
+    if (status == SUCCESS) {
+        int total = 0, worst = 100;
+        const char *worstReason = "EXCELLENT";
+        for (int i = 0; i < count; ++i) {
+            int grade = 0;
+            const char *reason = "SKIPPED";
+            if (!failFast || worst >= 75) {
+                if (runCase(&cases[i], &grade, &reason, &caseOutputs[i]) == ERROR || flushDue() == ERROR) {
+                    return ERROR;
+                }
+                if (grade < worst) {
+                    worst = grade;
+                    worstReason = reason;
+                }
+            }
+            total += grade;
+            caseReasons[i] = reason;
+        }
+        char grade[12];
+        snprintf(grade, sizeof(grade), "%d", total / count);
+        if (writeResult(name, grade, worstReason) == ERROR) {
+            return ERROR;
+        }
+    }
+
+    // Cleanup - remove redundent files.
+    if (removeBinary() == ERROR || safeRemove(OUTPUT) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     runWorker
+* Input:        Scratch directory, target directory, the submissions, the test
+*               cases, and the results file.
+* Output:       0 for success, -1 for failure.
+* Operation:    The body of a worker process. The worker opens the results file
+*               (shared by all workers, see Sink) and moves into its own scratch
+*               directory, so BINARY, OUTPUT and ERRORS are private to it, and
+*               then grades submissions one by one. Each
+*               submission is claimed by atomically incrementing shared->next,
+*               so fast workers simply take more of them. The results are written
+*               through a sink that stays open until the worker is done, the trace
+*               events (if --trace asked for them) to TRACE, and the manifest
+*               lines (if --incremental asked for them) to WORKER_MANIFEST.
+***********************************************************************************/
+int runWorker(const char *scratch, const char *target, const Submission *submissions, int count,
+              const TestCase *cases, int caseCount, const char *into) {
+
+    // Open the results file (by the path of the parent), and enter the scratch directory.
+    if (openSink(into) == ERROR) {
+        return ERROR;
+    }
+    if (chdir(scratch) == ERROR) {
+        print("Error in: chdir\n");
+        closeSink();
+        return ERROR;
+    }
+
+    // Trace to a file of its own, rather than to the one of the parent.
+    if (traceFD != ERROR) {
+        close(traceFD);
+        if ((traceFD = open(TRACE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)) == ERROR) {
+            print("Error in: open\n");
+            return ERROR;
+        }
+    }
+
+    // Record the submissions in a manifest of its own (incremental runs only).
+    if (stateDirectory != NULL) {
+        manifestFD = open(WORKER_MANIFEST, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (manifestFD == ERROR) {
+            print("Error in: open\n");
+            return ERROR;
+        }
+    }
+
+    // Grade submissions until none is left.
+    int i;
+    while ((i = __atomic_fetch_add(&shared->next, 1, __ATOMIC_RELAXED)) < count) {
+        long begin = traceNow();
+        traceSubmission = submissions[i].name;
+        if (gradeSubmission(target, &submissions[i], cases, caseCount) == ERROR) {
+            closeSink();
+            return ERROR;
+        }
+        traceEvent("submission", begin);
+    }
+    int status = closeSink();
+    leaveMemoryGroup();
+    if (traceFD != ERROR) {
+        close(traceFD);
+    }
+    if (manifestFD != ERROR && close(manifestFD) == ERROR) {
+        print("Error in: close\n");
+        status = ERROR;
+    }
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     compareLongs
+* Input:        Two long pointers (qsort() style).
+* Output:       Negative, zero or positive, by the values.
+* Operation:    Orders longs from small to large.
+***********************************************************************************/
+int compareLongs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************************************
+* Function:     summarizeTrace
+* Input:        None.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads the events of the trace file back, and prints a table of
+*               the count, total and p50/p95/p99 duration (in milliseconds) of
+*               every phase. Percentiles are by the nearest rank.
+***********************************************************************************/
+int summarizeTrace(void) {
+
+    // Read the whole trace.
+    int fd = open(traceFile, O_RDONLY);
+    struct stat traceStat;
+    if (fd == ERROR || fstat(fd, &traceStat) == ERROR) {
+        print("Error in: open\n");
+        if (fd != ERROR) {
+            close(fd);
+        }
+        return ERROR;
+    }
+    char *content = malloc(traceStat.st_size + 1);
+    ssize_t received = content != NULL ? read(fd, content, traceStat.st_size) : ERROR;
+    close(fd);
+    if (received != traceStat.st_size) {
+        print("Error in: read\n");
+        free(content);
+        return ERROR;
+    }
+    content[received] = '\0';
+
+    // Collect the durations of every phase -- there are never more than lines.
+    size_t lines = 1;
+    for (char *p = content; *p; ++p) {
+        lines += *p == '\n';
+    }
+    long *durations[TRACE_PHASES];
+    int counts[TRACE_PHASES] = {0};
+    for (int i = 0; i < TRACE_PHASES; ++i) {
+        durations[i] = malloc(lines * sizeof(long));
+    }
+    for (char *line = strtok(content, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        char phase[16];
+        long duration;
+        if (sscanf(line, "{\"name\":\"%15[^\"]\",\"ph\":\"X\",\"ts\":%*d,\"dur\":%ld", phase, &duration) != 2) {
+            continue;
+        }
+        for (int i = 0; i < TRACE_PHASES; ++i) {
+            if (durations[i] != NULL && !strcmp(phase, tracePhases[i])) {
+                durations[i][counts[i]++] = duration;
+            }
+        }
+    }
+    free(content);
+
+    // Print the table.
+    char row[128];
+    print("phase           count    total ms      p50 ms      p95 ms      p99 ms\n");
+    for (int i = 0; i < TRACE_PHASES; ++i) {
+        if (counts[i] > 0) {
+            long total = 0;
+            for (int j = 0; j < counts[i]; ++j) {
+                total += durations[i][j];
+            }
+            qsort(durations[i], counts[i], sizeof(long), compareLongs);
+            long p50 = durations[i][(counts[i] * 50 + 99) / 100 - 1];
+            long p95 = durations[i][(counts[i] * 95 + 99) / 100 - 1];
+            long p99 = durations[i][(counts[i] * 99 + 99) / 100 - 1];
+            snprintf(row, sizeof(row), "%-12s %8d %11.1f %11.1f %11.1f %11.1f\n", tracePhases[i], counts[i],
+                     total / 1000.0, p50 / 1000.0, p95 / 1000.0, p99 / 1000.0);
+            print(row);
+        }
+        free(durations[i]);
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     finishTrace
+* Input:        The number of workers.
+* Output:       0 for success, -1 for error.
+* Operation:    Names the lanes of the trace -- main for the parent and worker N
+*               for every worker -- so Perfetto shows a lane per worker, closes
+*               the trace file and prints its summary (see summarizeTrace()).
+***********************************************************************************/
+int finishTrace(int workers) {
+    char event[128];
+    int status = SUCCESS;
+    for (int lane = 0; lane <= workers && status == SUCCESS; ++lane) {
+        int length = lane == 0 ? snprintf(event, sizeof(event), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                                          "\"tid\":0,\"args\":{\"name\":\"main\"}},\n")
+                               : snprintf(event, sizeof(event), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                                          "\"tid\":%d,\"args\":{\"name\":\"worker %d\"}},\n", lane, lane);
+        if (write(traceFD, event, length) != length) {
+            status = ERROR;
+        }
+    }
+    const char *end = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+                      "\"args\":{\"name\":\"ex32\"}}\n]}\n";
+    if (status == ERROR || write(traceFD, end, strlen(end)) != (ssize_t)strlen(end)) {
+        print("Error in: write\n");
+        status = ERROR;
+    }
+    close(traceFD);
+    traceFD = ERROR;
+    return status == SUCCESS ? summarizeTrace() : ERROR;
+}
+
+/**********************************************************************************
+* Function:     startManifest
+* Input:        A buffer for the path of the next manifest, the test cases, and
+*               their number.
+* Output:       0 for success, -1 for error.
+* Operation:    Creates the manifest of this run next to the one of the last run,
+*               and writes its header -- the settings the grades depend on and
+*               the hashes of the input and correct output of every case. The
+*               workers' lines are added to it, and it replaces the manifest of
+*               the last run once the run succeeded.
+***********************************************************************************/
+int startManifest(char *path, const TestCase *cases, int count) {
+    snprintf(path, PATH_MAX, "%s" MANIFEST_NEXT, stateDirectory);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == ERROR) {
+        print("Error in: open\n");
+        return ERROR;
+    }
+    char field[48];
+    int length = snprintf(field, sizeof(field), MANIFEST_MAGIC "\t%016lx\t%d", (unsigned long)manifestSettings,
+                          count);
+    int status = write(fd, field, length) == length ? SUCCESS : ERROR;
+    for (int i = 0; i < count && status == SUCCESS; ++i) {
+        length = snprintf(field, sizeof(field), "\t%016lx:%016lx", (unsigned long)cases[i].inputHash,
+                          (unsigned long)cases[i].correctHash);
+        status = write(fd, field, length) == length ? SUCCESS : ERROR;
+    }
+    if (status == ERROR || write(fd, "\n", 1) != 1) {
+        print("Error in: write\n");
+        status = ERROR;
+    }
+    close(fd);
+    return status;
+}
+
+/**********************************************************************************
+* Function:     compareHashes
+* Input:        Two uint64_t pointers (qsort() style).
+* Output:       Negative, zero or positive, by the values.
+* Operation:    Orders hashes from small to large.
+***********************************************************************************/
+int compareHashes(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************************************
+* Function:     pruneOutputs
+* Input:        The path of the manifest that was just put in place.
+* Output:       0 for success, -1 for error.
+* Operation:    Removes the kept outputs (see keepOutput()) that no case of the
+*               manifest refers to anymore -- the outputs of programs that were
+*               changed or removed since, and the temporary files of workers that
+*               died -- so the state directory doesn't grow from run to run.
+*               Nothing is removed if the manifest can't be read.
+***********************************************************************************/
+int pruneOutputs(const char *manifest) {
+
+    // Read the whole manifest.
+    int fd = open(manifest, O_RDONLY | O_CLOEXEC);
+    struct stat manifestStat;
+    char *content = NULL;
+    ssize_t received = ERROR;
+    if (fd != ERROR && fstat(fd, &manifestStat) == SUCCESS
+        && (content = malloc(manifestStat.st_size + 1)) != NULL) {
+        received = read(fd, content, manifestStat.st_size);
+    }
+    if (fd != ERROR) {
+        close(fd);
+    }
+    if (content == NULL || received != manifestStat.st_size) {
+        print("Error in: read\n");
+        free(content);
+        return ERROR;
+    }
+    content[received] = '\0';
+
+    // Collect the outputs of the cases of every submission (the fields after the first five, see
+    // recordSubmission()), past the header, and sort them.
+    uint64_t *hashes = NULL;
+    size_t count = 0, capacity = 0;
+    char *next = content, *line = strsep(&next, "\n");
+    while ((line = strsep(&next, "\n")) != NULL) {
+        char *field;
+        for (int i = 0; (field = strsep(&line, "\t")) != NULL; ++i) {
+            char *colon = strrchr(field, ':');
+            if (i < 5 || colon == NULL) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                uint64_t *grown = realloc(hashes, capacity * sizeof(uint64_t));
+                if (grown == NULL) {
+                    print("Error in: realloc\n");
+                    free(hashes);
+                    free(content);
+                    return ERROR;
+                }
+                hashes = grown;
+            }
+            hashes[count++] = strtoull(colon + 1, NULL, 16);
+        }
+    }
+    free(content);
+    qsort(hashes, count, sizeof(uint64_t), compareHashes);
+
+    // Remove every file of the outputs directory that isn't one of them.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s" KEPT_OUTPUTS, stateDirectory);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        print("Error in: opendir\n");
+        free(hashes);
+        return ERROR;
+    }
+    int status = SUCCESS;
+    struct dirent *dirEnt;
+    while ((dirEnt = readdir(dir)) != NULL) {
+        char *end;
+        uint64_t hash = strtoull(dirEnt->d_name, &end, 16);
+        if (dirEnt->d_name[0] == '.' || (*end == '\0' && end - dirEnt->d_name == 16
+            && bsearch(&hash, hashes, count, sizeof(uint64_t), compareHashes) != NULL)) {
+            continue;
+        }
+        if (unlinkat(dirfd(dir), dirEnt->d_name, 0) == ERROR && errno != ENOENT) {
+            print("Error in: unlink\n");
+            status = ERROR;
+        }
+    }
+    closedir(dir);
+    free(hashes);
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     gradeBatch
+* Input:        Target directory, the submissions to grade, the test cases, the
+*               number of workers, and the file to add the results to.
+* Output:       0 for success, -1 for failure.
+* Operation:    Creates a scratch directory for each worker, and forks the workers
+*               that grade the submissions (see runWorker()). The workers append
+*               their results to the given file as they flush them. Once all
+*               workers are done, their errors are merged into errors.txt, the
+*               scratch directories are removed, and the compilation cache (if
+*               enabled) is trimmed to its size bound.
+*               An incremental run replaces the manifest with the one of this
+*               batch, and drops the kept outputs it no longer refers to. With
+*               --trace, the trace events of the parent and the workers are
+*               merged into the trace file as well (while it is open), and the
+*               hits and misses of the output caches are reported.
+***********************************************************************************/
+int gradeBatch(const char *target, const Submission *submissions, int count, const TestCase *cases,
+               int caseCount, int jobs, const char *into) {
+
+    if (jobs > count) {
+        jobs = count;
+    }
+
+    // Start the next manifest with the settings and the hashes of the cases (incremental runs only).
+    char manifestNext[PATH_MAX];
+    if (stateDirectory != NULL && startManifest(manifestNext, cases, caseCount) == ERROR) {
+        return ERROR;
+    }
+
+    // Share the next submission to grade and the counters between the workers.
+    shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        print("Error in: mmap\n");
+        return ERROR;
+    }
+    memset(shared, 0, sizeof(Shared));
+
+    // Create the scratch directories and fork the workers.
+    char scratch[jobs > 0 ? jobs : 1][sizeof(SCRATCH)];
+    pid_t workers[jobs > 0 ? jobs : 1];
+    int started = 0, status = SUCCESS;
+    for (; started < jobs; ++started) {
+        strcpy(scratch[started], SCRATCH);
+        if (mkdtemp(scratch[started]) == NULL) {
+            print("Error in: mkdtemp\n");
+            status = ERROR;
+            break;
+        }
+        workers[started] = fork();
+        if (workers[started] == 0) {
+            traceLane = started + 1;
+            int worked = runWorker(scratch[started], target, submissions, count, cases, caseCount, into);
+            _exit(worked == SUCCESS ? SUCCESS : 1);
+        }
+        if (workers[started] < 0) {
+            print("Error in: fork\n");
+            rmdir(scratch[started]);
+            status = ERROR;
+            break;
+        }
+    }
+
+    // Wait for the workers, then merge and remove their scratch directories.
+    for (int i = 0; i < started; ++i) {
+        int workerStatus;
+        if (waitpid(workers[i], &workerStatus, 0) == ERROR) {
+            print("Error in: waitpid\n");
+            status = ERROR;
+        } else if (!WIFEXITED(workerStatus) || WEXITSTATUS(workerStatus) != SUCCESS) {
+            status = ERROR;
+        }
+        char path[PATH_MAX];
+        const char *files[] = {ERRORS, TRACE, WORKER_MANIFEST, BINARY, OUTPUT};
+        const char *targets[] = {errorsFile, traceFile, stateDirectory ? manifestNext : NULL};
+        for (int f = 0; f < 5; ++f) {
+            strcpy(path, scratch[i]);
+            strcat(path, files[f] + 1);
+            if ((f < 3 && targets[f] != NULL && mergeFile(path, targets[f], 1) == ERROR)
+                || safeRemove(path) == ERROR) {
+                status = ERROR;
+            }
+        }
+        if (rmdir(scratch[i]) == ERROR) {
+            print("Error in: rmdir\n");
+            status = ERROR;
+        }
+    }
+
+    // Close the trace, and summarize it along with how well the output caches did.
+    if (traceFD != ERROR && finishTrace(started) == ERROR) {
+        status = ERROR;
+    }
+    if (traceFile != NULL) {
+        char report[100];
+        snprintf(report, sizeof(report), "Output cache: %d hits, %d misses\n", shared->outputHits,
+                 shared->outputMisses);
+        print(report);
+    }
+
+    // Replace the manifest once every worker is done and drop the outputs it doesn't refer to, and report
+    // how much of the last run was kept.
+    if (stateDirectory != NULL) {
+        char path[PATH_MAX], report[100];
+        snprintf(path, sizeof(path), "%s" MANIFEST, stateDirectory);
+        if (status == SUCCESS && rename(manifestNext, path) == ERROR) {
+            print("Error in: rename\n");
+            status = ERROR;
+        } else if (status == SUCCESS && pruneOutputs(path) == ERROR) {
+            status = ERROR;
+        }
+        snprintf(report, sizeof(report), "Incremental: %d reused, %d regraded\n", shared->reused,
+                 shared->regraded);
+        print(report);
+    }
+
+    // Bound the compilation cache and report how well it did.
+    if (cacheDirectory != NULL) {
+        evictCache();
+        char report[100];
+        snprintf(report, sizeof(report), "Compilation cache: %d hits, %d misses\n", shared->cacheHits,
+                 shared->cacheMisses);
+        print(report);
+    }
+
+    munmap(shared, sizeof(Shared));
+    return status;
+    
+}
+
+/**********************************************************************************
+* Function:     measureReference
+* Input:        The path of the reference solution, the test cases, and their
+*               number.
+* Output:       0 for success, -1 for error.
+* Operation:    The body of calibrateTimeouts(), in the current directory --
+*               compiles the reference solution into BINARY (its errors go to
+*               ERRORS), times it on every case, and sets their time limits.
+***********************************************************************************/
+int measureReference(const char *source, TestCase *cases, int count) {
+
+    // Compile the reference solution.
+    if (createBinary() == ERROR) {
+        return ERROR;
+    }
+    char *command[] = {COMPILER, "-o", binaryPath, (char *)source, NULL};
+    if (execute(command, NULL, 0, NULL, NULL, NULL) != SUCCESS || !binaryExists() || sealBinary() == ERROR) {
+        print("Reference solution failed to compile\n");
+        removeBinary();
+        return ERROR;
+    }
+
+    // Run it on every case. Its outputs go through the output cache like any other (and the workers inherit
+    // the cache), so it needs counters too.
+    Shared counters = {0};
+    shared = &counters;
+    int status = SUCCESS;
+    long wall[referenceRuns], cpu[referenceRuns];
+    for (int i = 0; i < count && status == SUCCESS; ++i) {
+        cases[i].timeLimit = timeoutCeiling;
+        for (int run = 0; run < referenceRuns && status == SUCCESS; ++run) {
+            Capture capture;
+            if (beginCapture(&capture, &cases[i]) == ERROR) {
+                print("Error in: malloc\n");
+                status = ERROR;
+                break;
+            }
+            memset(&lastUsage, 0, sizeof(lastUsage));
+            int result = runProgram(cases[i].input, &capture);
+            int verdict = endCapture(&capture);
+            if (result != SUCCESS || (verdict != IDENTICAL && verdict != SIMILAR)) {
+                char report[64];
+                snprintf(report, sizeof(report), "Reference solution failed case %d\n", i + 1);
+                print(report);
+                status = ERROR;
+            }
+            wall[run] = lastUsage.wallMs;
+            cpu[run] = lastUsage.userMs + lastUsage.systemMs;
+        }
+        if (status == ERROR) {
+            break;
+        }
+
+        // Take the medians as the baseline, and set the time limit by it.
+        qsort(wall, referenceRuns, sizeof(long), compareLongs);
+        qsort(cpu, referenceRuns, sizeof(long), compareLongs);
+        cases[i].baselineWallMs = wall[referenceRuns / 2];
+        cases[i].baselineCpuMs = cpu[referenceRuns / 2];
+        long timeLimit = (long)(timeoutFactor * cases[i].baselineWallMs);
+        if (timeoutCeiling > 0 && timeLimit > timeoutCeiling) {
+            timeLimit = timeoutCeiling;
+        }
+        if (timeLimit < timeoutFloor) {
+            timeLimit = timeoutFloor;
+        }
+        cases[i].timeLimit = timeLimit > 0 ? timeLimit : 1;
+        char report[128];
+        snprintf(report, sizeof(report), "Calibration: case %d took %ld ms (%ld ms CPU), time limit %ld ms\n",
+                 i + 1, cases[i].baselineWallMs, cases[i].baselineCpuMs, cases[i].timeLimit);
+        print(report);
+    }
+    shared = NULL;
+    if (removeBinary() == ERROR) {
+        status = ERROR;
+    }
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     calibrateTimeouts
+* Input:        The test cases, and their number.
+* Output:       0 for success, -1 for error.
+* Operation:    Compiles the reference solution (see --reference) and runs it
+*               referenceRuns times on every case, under the limits of any
+*               program and with its output compared the same way. The median
+*               wall and CPU (user and system) times of its runs are the baseline
+*               of the case, and the time limit of the case is timeoutFactor times
+*               the wall baseline, bounded by timeoutFloor and timeoutCeiling (0
+*               for no bound). So a program that loops forever on a trivial input
+*               is stopped early, and one on a heavy input isn't stopped only for
+*               running on a loaded machine. A reference solution that doesn't
+*               compile, or that isn't EXCELLENT or SIMILAR on every case within
+*               timeoutCeiling, fails the run, as its times would mean nothing.
+*               It runs in a scratch directory of its own, like a worker (see
+*               runWorker()), and its compiler errors go to the errors file.
+***********************************************************************************/
+int calibrateTimeouts(TestCase *cases, int count) {
+
+    // Enter a scratch directory, with the reference solution by an absolute path.
+    char scratch[] = SCRATCH;
+    char *source = realpath(referenceSource, NULL);
+    if (source == NULL) {
+        print("Error in: realpath\n");
+        return ERROR;
+    }
+    int home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (home == ERROR || mkdtemp(scratch) == NULL) {
+        print(home == ERROR ? "Error in: open\n" : "Error in: mkdtemp\n");
+        if (home != ERROR) {
+            close(home);
+        }
+        free(source);
+        return ERROR;
+    }
+    int status = chdir(scratch) == SUCCESS ? measureReference(source, cases, count) : ERROR;
+    leaveMemoryGroup();
+    free(source);
+
+    // Go back, merge the errors into the errors file, and remove the scratch directory.
+    if (fchdir(home) == ERROR) {
+        print("Error in: chdir\n");
+        close(home);
+        return ERROR;
+    }
+    close(home);
+    char path[PATH_MAX];
+    const char *files[] = {ERRORS, BINARY, OUTPUT};
+    for (int f = 0; f < 3; ++f) {
+        snprintf(path, sizeof(path), "%s%s", scratch, files[f] + 1);
+        if ((f == 0 && mergeFile(path, errorsFile, 1) == ERROR) || safeRemove(path) == ERROR) {
+            status = ERROR;
+        }
+    }
+    if (rmdir(scratch) == ERROR) {
+        print("Error in: rmdir\n");
+        status = ERROR;
+    }
+    calibrated = status == SUCCESS ? cases : NULL;
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     runTest
+* Input:        Target directory, the test cases, and the number of workers.
+* Output:       0 for success, -1 for failure.
+* Operation:    This is the main test function. It lists the submissions and
+*               grades all of them into results.csv (see gradeBatch()), traced
+*               from the start if --trace asked for it. The target directory and
+*               the input files must be absolute paths, since the workers change
+*               their working directory.
+***********************************************************************************/
+int runTest(const char *target, const TestCase *cases, int caseCount, int jobs) {
+
+    // Start the trace (if asked to).
+    if (traceFile != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &traceStart);
+        const char *header = "{\"traceEvents\":[\n";
+        traceFD = open(traceFile, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (traceFD == ERROR || write(traceFD, header, strlen(header)) != (ssize_t)strlen(header)) {
+            print("Error in: open\n");
+            return ERROR;
+        }
+    }
+
+    // List the submissions and their C files.
+    Submission *submissions;
+    int count;
+    long begin = traceNow();
+    if (collectSubmissions(target, &submissions, &count, 1) == ERROR) {
+        releaseSubmissions(submissions, count);
+        return ERROR;
+    }
+    traceEvent("discover", begin);
+
+    // Grade them all.
+    int status = gradeBatch(target, submissions, count, cases, caseCount, jobs, resultsFile);
+    releaseSubmissions(submissions, count);
+    return status;
+
+}
+
+/**********************************************************************************
+* Function:     setupChecks
+* Input:        Target directory, the test cases, and their number.
+* Output:       0 for success, -1 for failure.
+* Operation:    This function replaces old errors and results files and
+*               verifies that the given target directory, and the input file and
+*               correct output file of every case are exists and from the correct
+*               types.
+***********************************************************************************/
+int setupChecks(const char *directory, const TestCase *cases, int count) {
+
+    // Remove old files if exists.
+    if (safeRemove(errorsFile) == ERROR || safeRemove(resultsFile) == ERROR) {
+        return ERROR;
+    }
+
+    // Start an empty results file, so a run (or a shard) without submissions leaves one too.
+    int resultsFD = open(resultsFile, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (resultsFD == ERROR || close(resultsFD) == ERROR) {
+        print("Error in: open\n");
+        return ERROR;
+    }
+
+    // Create stat to identify entry type.
+    struct stat entry;
+
+    // Verify target dictionary existance and type.
+    if (access(directory, F_OK) != SUCCESS || stat(directory, &entry) == ERROR || !S_ISDIR(entry.st_mode)) {
+        print("Not a valid directory\n");
+        return ERROR;
+    }
+
+    for (int i = 0; i < count; ++i) {
+
+        // Verify input file existance and type.
+        if (access(cases[i].input, F_OK) != SUCCESS || stat(cases[i].input, &entry) == ERROR
+            || !S_ISREG(entry.st_mode)) {
+            print("Input file not exist\n");
+            return ERROR;
+        }
+
+        // Verify output file existance.
+        if (access(cases[i].correct, F_OK) != SUCCESS || stat(cases[i].correct, &entry) == ERROR
+            || !S_ISREG(entry.st_mode)) {
+            print("Output file not exist\n");
+            return ERROR;
+        }
+
+    }
+
+    // Return 0 if all checked.
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Function:     loadInput
+* Input:        A test case.
+* Output:       0 for success, -1 for error.
+* Operation:    Copies the input of the case into a memory file, seals it so no
+*               program can change it, and makes it the input of the case.
+***********************************************************************************/
+int loadInput(TestCase *testCase) {
+    int inputFD = open(testCase->input, O_RDONLY);
+    int fd = memfd_create("input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    struct stat inputStat;
+    int status = inputFD != ERROR && fd != ERROR && fstat(inputFD, &inputStat) == SUCCESS ? SUCCESS : ERROR;
+    for (off_t done = 0; status == SUCCESS && done < inputStat.st_size;) {
+        ssize_t copied = sendfile(fd, inputFD, NULL, inputStat.st_size - done);
+        if (copied <= 0) {
+            status = ERROR;
+        }
+        done += copied;
+    }
+    if (inputFD != ERROR) {
+        close(inputFD);
+    }
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+    if (status == SUCCESS && fcntl(fd, F_ADD_SEALS, seals) == ERROR) {
+        status = ERROR;
+    }
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    char *input = status == SUCCESS ? strdup(path) : NULL;
+    if (input == NULL) {
+        print("Error in: memfd_create\n");
+        return ERROR;
+    }
+    free(testCase->input);
+    testCase->input = input;
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     loadConfiguration
+* Input:        Path to the configuration file, and pointers for the target
+*               directory, the test cases and their number.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads the configuration file -- the target directory in the first
+*               line, followed by pairs of lines with an input file and the file
+*               of its correct output, one pair for each test case. The paths
+*               point into one buffer that stays allocated for the whole run.
+***********************************************************************************/
+int loadConfiguration(const char *path, char **target, TestCase **cases, int *count) {
+
+    // Open configuration file.
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        print("Error in: open\n");
+        return ERROR;
+    }
+
+    // Set buffer and read configuration file.
+    struct stat confStat;
+    if (fstat(fd, &confStat) == ERROR) {
+        print("Error in: fstat\n");
+        close(fd);
+        return ERROR;
+    }
+    char *buffer = calloc(confStat.st_size + 1, 1);
+    if (buffer == NULL || read(fd, buffer, confStat.st_size) == ERROR) {
+        print("Error in: read\n");
+        free(buffer);
+        close(fd);
+        return ERROR;
+    }
+
+    // Close configuration file descriptor.
+    if (close(fd) == ERROR) {
+        print("Error in: close\n");
+        free(buffer);
+        return ERROR;
+    }
+
+    // Extract information from the configuration file -- the target, then an input and an output per case.
+    *target = strtok(buffer, "\n");
+    *cases = NULL;
+    *count = 0;
+    char *input;
+    while ((input = strtok(NULL, "\n")) != NULL) {
+        char *correct = strtok(NULL, "\n");
+        if (correct == NULL) {
+            break;
+        }
+        TestCase *grown = realloc(*cases, (*count + 1) * sizeof(TestCase));
+        if (grown == NULL) {
+            print("Error in: realloc\n");
+            return ERROR;
+        }
+        *cases = grown;
+        (*cases)[*count].input = input;
+        (*cases)[*count].correct = correct;
+        (*cases)[*count].timeLimit = TIME_LIMIT;
+        ++*count;
+    }
+    if (*target == NULL || *count == 0) {
+        print("Invalid configuration file\n");
+        return ERROR;
+    }
+    return SUCCESS;
+
+}
+
+/**********************************************************************************
+* Struct:       Row
+* Operation:    A row of a shard's results -- the line itself (without its
+*               line-break) and the key it is sorted by: the name as the row
+*               holds it (quoted and escaped in JSON Lines).
+***********************************************************************************/
+typedef struct {
+    char *key;
+    char *line;
+} Row;
+
+/**********************************************************************************
+* Function:     compareRows
+* Input:        Two Row pointers (qsort() style).
+* Output:       Negative, zero or positive, by the keys of the rows.
+* Operation:    Orders rows by name.
+***********************************************************************************/
+int compareRows(const void *a, const void *b) {
+    return strcmp(((const Row *)a)->key, ((const Row *)b)->key);
+}
+
+/**********************************************************************************
+* Function:     readShard
+* Input:        A results file of a shard, and the rows array with its size and
+*               capacity.
+* Output:       0 for success, -1 for error.
+* Operation:    Reads the whole file and adds each of its lines to the rows. The
+*               key of a CSV row is its first column, and the key of a JSON Lines
+*               row is the "name" string it starts with.
+***********************************************************************************/
+int readShard(const char *path, Row **rows, size_t *count, size_t *capacity) {
+
+    // Read the whole file.
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+    struct stat shardStat;
+    if (fstat(fd, &shardStat) == ERROR) {
+        print("Error in: fstat\n");
+        close(fd);
+        return ERROR;
+    }
+    char *content = malloc(shardStat.st_size + 1);
+    ssize_t received = ERROR;
+    if (content != NULL) {
+        received = read(fd, content, shardStat.st_size);
+    }
+    close(fd);
+    if (received != shardStat.st_size) {
+        print("Error in: read\n");
+        free(content);
+        return ERROR;
+    }
+    content[received] = '\0';
+
+    // Split it to rows and find the key of each.
+    const char *prefix = "{\"name\":";
+    for (char *line = strtok(content, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        const char *key = line;
+        size_t length = strcspn(line, ",");
+        if (resultsFormat == FORMAT_JSONL && !strncmp(line, prefix, strlen(prefix))) {
+            key = line + strlen(prefix);
+            for (length = 1; key[length] != '\0' && key[length] != '"'; ++length) {
+                if (key[length] == '\\' && key[length + 1] != '\0') {
+                    ++length;
+                }
+            }
+            length += key[length] == '"';
+        }
+        if (*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 256;
+            Row *grown = realloc(*rows, *capacity * sizeof(Row));
+            if (grown == NULL) {
+                print("Error in: realloc\n");
+                free(content);
+                return ERROR;
+            }
+            *rows = grown;
+        }
+        Row *row = &(*rows)[*count];
+        row->key = strndup(key, length);
+        row->line = strdup(line);
+        if (row->key == NULL || row->line == NULL) {
+            print("Error in: strdup\n");
+            free(row->key);
+            free(row->line);
+            free(content);
+            return ERROR;
+        }
+        ++*count;
+    }
+    free(content);
     return SUCCESS;
 
 }
 
 /**********************************************************************************
-* Function:     execute
-* Input:        Arguments for execvp() and a path for an input file (maybe NULL).
-* Output:       0 for success, -1 for error, ex31.c return value, or 124 for time-out.
-* Operation:    Uses fork() and execvp() to run the given command. Note that the 
-*               child is responsible for IO redirection and the parent is
-*               responsible for getting the output/timeout of the execution.
+* Function:     mergeShards
+* Input:        argc, argv -- the arguments of the merge subcommand:
+*               merge [-F csv|jsonl] N <configuration file>.
+* Output:       0 if the shards merged cleanly, -1 otherwise.
+* Operation:    Combines the results and errors files of shards 0 to N-1 (see
+*               --shard) into one results file sorted by name and one
+*               errors.txt. The rows are checked against the submissions of the
+*               target directory -- a missing shard file, a submission that no
+*               shard graded, a submission graded twice and a row of an unknown
+*               submission are all reported and fail the merge. Only the first
+*               row of a duplicate is kept. The shard files are left in place.
 ***********************************************************************************/
-int execute(char **command, const char *inputFile) {
-
-    // Fork in order to call a bash command without loosing the memory allocated for this program.
-    pid_t pid = fork();
-
-    // Child executing process.
-    if (pid == 0) {
+int mergeShards(int argc, char **argv) {
 
-        // Redirect output to output.txt (temp) file and errors to errors.txt file.
-        if (ioRedirection(ERRORS, 2) == ERROR || ioRedirection(OUTPUT, 1) == ERROR) {
+    // Parse the arguments.
+    int option;
+    while ((option = getopt(argc, argv, "F:")) != -1) {
+        if (option == 'F' && (!strcmp(optarg, "csv") || !strcmp(optarg, "jsonl"))) {
+            resultsFormat = !strcmp(optarg, "csv") ? FORMAT_CSV : FORMAT_JSONL;
+            resultsFile = resultsFormat == FORMAT_CSV ? RESULTS : RESULTS_JSONL;
+        } else {
+            print(USAGE);
             return ERROR;
         }
-
-        // Redirect input from the given inputFile (if given).
-        if (inputFile != NULL && ioRedirection(inputFile, 0)) {
-            return ERROR;
-        }   
-
-        // User execvp() to execute command.
-        if (execvp(command[0], command) != SUCCESS) {
-            print("Error in: execvp\n");
-            return ERROR;
-        }      
+    }
+    int shards = optind + 2 == argc ? strtol(argv[optind], NULL, 10) : 0;
+    if (shards < 1) {
+        print(USAGE);
+        return ERROR;
     }
 
-    // Parent waiting process.
-    else if (pid > 0) {
+    // List every submission of the target directory, as the rows hold their names.
+    char *target;
+    Submission *submissions;
+    TestCase *cases;
+    int caseCount, nameCount;
+    if (loadConfiguration(argv[optind + 1], &target, &cases, &caseCount) == ERROR) {
+        return ERROR;
+    }
+    free(cases);
+    if (collectSubmissions(target, &submissions, &nameCount, 0) == ERROR) {
+        releaseSubmissions(submissions, nameCount);
+        return ERROR;
+    }
+    Row *expected = calloc(nameCount ? nameCount : 1, sizeof(Row));
+    if (expected == NULL) {
+        print("Error in: calloc\n");
+        releaseSubmissions(submissions, nameCount);
+        return ERROR;
+    }
+    int status = SUCCESS;
+    for (int i = 0; i < nameCount; ++i) {
+        const char *name = submissions[i].name;
+        expected[i].key = resultsFormat == FORMAT_CSV ? strdup(name) : quoteJSON(name);
+        if (expected[i].key == NULL) {
+            status = ERROR;
+        }
+    }
+    releaseSubmissions(submissions, nameCount);
 
-        // Wait for the child to finish.
-        int status;
-        if (waitpid(pid, &status, WUNTRACED) == ERROR) {
-            print("Error in: waitpid\n");
-            return ERROR;
+    // Read the rows of every shard.
+    Row *rows = NULL;
+    size_t count = 0, capacity = 0;
+    char path[PATH_MAX], report[PATH_MAX + 32];
+    for (int i = 0; i < shards && status != ERROR; ++i) {
+        snprintf(path, sizeof(path), resultsFormat == FORMAT_CSV ? SHARD_RESULTS : SHARD_RESULTS_JSONL, i, shards);
+        if (access(path, F_OK) != SUCCESS) {
+            snprintf(report, sizeof(report), "Missing shard: %s\n", path);
+            print(report);
+            status = FAILURE;
+        } else if (readShard(path, &rows, &count, &capacity) == ERROR) {
+            status = ERROR;
         }
+    }
 
-        // If child is timed-out, return 4 for failure.
-        if (inputFile != NULL && WIFEXITED(status) && WEXITSTATUS(status) == TIMED_OUT) {
-            return TIMED_OUT;
+    // Sort both, then walk them side by side and write the rows in order.
+    if (status != ERROR && (safeRemove(resultsFile) == ERROR || openSink(resultsFile) == ERROR)) {
+        status = ERROR;
+    }
+    if (status != ERROR) {
+        qsort(rows, count, sizeof(Row), compareRows);
+        qsort(expected, nameCount, sizeof(Row), compareRows);
+        size_t r = 0;
+        int e = 0;
+        while (r < count || e < nameCount) {
+            int order = r == count ? 1 : e == nameCount ? -1 : strcmp(rows[r].key, expected[e].key);
+            if (order > 0) {
+                snprintf(report, sizeof(report), "Missing: %s\n", expected[e++].key);
+                print(report);
+                status = FAILURE;
+                continue;
+            }
+            if (order < 0) {
+                snprintf(report, sizeof(report), "Unexpected: %s\n", rows[r].key);
+                print(report);
+                status = FAILURE;
+            } else {
+                ++e;
+            }
+            if (appendToSink("%s\n", rows[r].line) == ERROR) {
+                status = ERROR;
+                break;
+            }
+            for (++r; r < count && !strcmp(rows[r].key, rows[r - 1].key); ++r) {
+                snprintf(report, sizeof(report), "Duplicate: %s\n", rows[r].key);
+                print(report);
+                status = FAILURE;
+            }
         }
-        
-        // If chiled has finished on time, check exit-status and return it.
-        if (!strcmp(command[0], COMP) && WIFEXITED(status)) {
-            return WEXITSTATUS(status);
+        if (closeSink() == ERROR) {
+            status = ERROR;
         }
-
     }
 
-    // Case pid < 0 means fork() failed so return -1 for error.
-    else if (pid < 0) {
-        print("Error in: fork\n");
-        return ERROR;
+    // Concatenate the errors of the shards.
+    if (status != ERROR && safeRemove(ERRORS) == ERROR) {
+        status = ERROR;
+    }
+    for (int i = 0; i < shards && status != ERROR; ++i) {
+        snprintf(path, sizeof(path), SHARD_ERRORS, i, shards);
+        if (mergeFile(path, ERRORS, 0) == ERROR) {
+            status = ERROR;
+        }
     }
 
-    // Returns 0 for success.
-    return SUCCESS;
+    // Release the rows and the names.
+    for (size_t i = 0; i < count; ++i) {
+        free(rows[i].key);
+        free(rows[i].line);
+    }
+    for (int i = 0; i < nameCount; ++i) {
+        free(expected[i].key);
+    }
+    free(rows);
+    free(expected);
+    return status == SUCCESS ? SUCCESS : ERROR;
 
 }
 
 /**********************************************************************************
-* Function:     checkExtension
-* Input:        fileName - a string which represent a file name.
-* Output:       0 for success, 4 for failure
-* Operation:    Look for a sequence of chars: ".c\0" or: ".C\0" and return 0 for
-*               success. If couldn't find a sequence, return 4 for failure.
+* Function:     compareWatches
+* Input:        Two Watch pointers (qsort() style).
+* Output:       Negative, zero or positive, by the watch descriptors.
+* Operation:    Orders watches by watch descriptor.
 ***********************************************************************************/
-int checkExtension(const char *fileName) {
-
-    // Variables for a loop.
-    int i, lim = strlen(fileName);
-
-    // This loop checks the extension of the given fileName. 
-    for (i = 0; i < lim; ++i) {
-        if (fileName[i] == '.') {
-            if (fileName[i + 1] == 'c' || fileName[i + 1] == 'C') {
-                if (fileName[i + 2] == '\0') {
-                    return SUCCESS;
-                }
-            }
-        }
-    }
-
-    // If the file is have no C extension, return 4 for failure.
-    return FAILURE;
+int compareWatches(const void *a, const void *b) {
+    int x = ((const Watch *)a)->wd, y = ((const Watch *)b)->wd;
+    return (x > y) - (x < y);
+}
 
+/**********************************************************************************
+* Function:     findWatch
+* Input:        A watch descriptor.
+* Output:       Its watch, or NULL if it isn't one of a submission.
+* Operation:    Binary search in the watches.
+***********************************************************************************/
+Watch *findWatch(int wd) {
+    const Watch key = {.wd = wd};
+    return bsearch(&key, watches, watchCount, sizeof(Watch), compareWatches);
 }
 
 /**********************************************************************************
-* Function:     findAndCompile
-* Input:        Current directory name and the path to current directory.
-* Output:       0 for success, 4 for failure, -1 for significant error.
-* Operation:    This function traverse the the directory entities inside the
-*               current directory name and look for a C file with checkExtension()
-*               function. Once found, it uses execute() function to compile it.
-*               It also uses writeToCSV() function to .. write to CSV when needed. 
+* Function:     addWatch
+* Input:        Target directory, and the name of a submission.
+* Output:       The watch of the submission, or NULL for error.
+* Operation:    Watches the submission's directory for changes. inotify gives a
+*               directory that is watched already its old watch descriptor, so
+*               a submission renamed back and forth keeps one watch, under its
+*               latest name.
 ***********************************************************************************/
-int findAndCompile(const char *name, const char *directoryPath) {
+Watch *addWatch(const char *target, const char *name) {
 
-    // Initialize status variable to "not found". It will change if a C file is found.
-    char status = NOT_FOUND;
+    // Watch the directory.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", target, name);
+    int wd = inotify_add_watch(watchFD, path, WATCH_EVENTS);
+    if (wd == ERROR) {
+        print("Error in: inotify_add_watch\n");
+        return NULL;
+    }
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        print("Error in: strdup\n");
+        return NULL;
+    }
 
-    // Open current directory.
-    DIR *dir = opendir(directoryPath);
-    if (!dir) {
-        print("Error in: opendir\n");
-        return ERROR;
+    // Rename a watch it has already.
+    Watch *watch = findWatch(wd);
+    if (watch != NULL) {
+        watchesGone -= watch->name == NULL;
+        free(watch->name);
+        watch->name = copy;
+        return watch;
     }
-    
-    // This loop looks for the C file in the current directory.
-    struct dirent *dirEnt;
-    while ((dirEnt = readdir(dir)) != NULL) {
 
-        // Check file's extension.
-        if (checkExtension(dirEnt->d_name) == SUCCESS) {
+    // Or add a new one in its place -- watch descriptors mostly grow, so it is usually the last.
+    if (watchCount == watchCapacity) {
+        watchCapacity = watchCapacity ? watchCapacity * 2 : 64;
+        Watch *grown = realloc(watches, watchCapacity * sizeof(Watch));
+        if (grown == NULL) {
+            print("Error in: realloc\n");
+            free(copy);
+            return NULL;
+        }
+        watches = grown;
+    }
+    int i = watchCount++;
+    for (; i > 0 && watches[i - 1].wd > wd; --i) {
+        watches[i] = watches[i - 1];
+    }
+    watches[i] = (Watch){.wd = wd, .name = copy, .due = 0};
+    return &watches[i];
 
-            // Creates a path to the C file.
-            char path[PATH_MAX] = {0};
-            strcpy(path, directoryPath);
-            strcat(path, "/");
-            strcat(path, dirEnt->d_name);
+}
 
-            // Once found the '.c' file, create arguments for execute() function.
-            char *command[] = {"gcc", "-o", BINARY, path, NULL};
+/**********************************************************************************
+* Function:     dropWatch
+* Input:        A watch whose directory is not watched anymore.
+* Output:       None.
+* Operation:    Forgets the watch, and packs the watches once most of them are
+*               gone, so a watch that runs for days doesn't grow with every
+*               submission that came and went.
+***********************************************************************************/
+void dropWatch(Watch *watch) {
+    free(watch->name);
+    watch->name = NULL;
+    watch->due = 0;
+    if (++watchesGone * 2 <= watchCount) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < watchCount; ++i) {
+        if (watches[i].name != NULL) {
+            watches[kept++] = watches[i];
+        }
+    }
+    watchCount = kept;
+    watchesGone = 0;
+}
 
-            // Compile the C file using execute() function (that uses fork() and execvp()).
-            status = execute(command, NULL);
+/**********************************************************************************
+* Function:     handleEvent
+* Input:        Target directory, and an inotify event.
+* Output:       0 for success, -1 for error.
+* Operation:    Makes the submission an event is about due WATCH_QUIET ms from
+*               now, so a submission being uploaded is graded once it stops
+*               changing. A new directory in the target is watched, and the watch
+*               of a directory that was moved out of it is removed. The row of a
+*               directory that was deleted or moved out is due to be removed
+*               too. When inotify lost events, every submission is due.
+***********************************************************************************/
+int handleEvent(const char *target, const struct inotify_event *event) {
 
-            // If execution failed, relate as compilation error and return 4 for failure. If something went
-            // wrong, return -1 for error.
-            if (status != SUCCESS) {
-                if (closedir(dir)) {
-                    print("Error in: closedir\n");
-                    return ERROR;
-                }
-                if (writeToCSV(name, "10" ,"COMPILATION_ERROR") == ERROR) {
-                    return ERROR;
-                }
-                return FAILURE;
-            }
+    long due = elapsedMs(&watchStart) + WATCH_QUIET;
 
-            // Else, execution was success, so verify the existance of the binary file.
-            if (access(BINARY, F_OK) == SUCCESS) {
-                if (closedir(dir)) {
-                    print("Error in: closedir\n");
-                    return ERROR;
-                }
-                return SUCCESS;
+    // Events were lost, so anything may have changed.
+    if (event->mask & IN_Q_OVERFLOW) {
+        Submission *submissions;
+        int count, status = collectSubmissions(target, &submissions, &count, 0);
+        for (int i = 0; i < count && status == SUCCESS; ++i) {
+            Watch *watch = addWatch(target, submissions[i].name);
+            if (watch == NULL) {
+                status = ERROR;
+            } else {
+                watch->due = due;
             }
-
-        } 
-    }
-
-    // Close directory (return -1 if failed).
-    if (closedir(dir) == ERROR) {
-        print("Error in: closedir\n");
-        return ERROR;
+        }
+        releaseSubmissions(submissions, count);
+        return status;
     }
 
-    // Handle case C file not found.
-    if (status == NOT_FOUND) {
-        if (writeToCSV(name, "0" ,"NO_C_FILE") == ERROR) {
+    // A submission's directory came or went.
+    if (event->wd == targetWatch) {
+        if (!(event->mask & IN_ISDIR) || event->len == 0
+            || hashBytes(FNV_OFFSET, event->name, strlen(event->name)) % shardCount != (uint64_t)shardIndex) {
+            return SUCCESS;
+        }
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            Watch *watch = addWatch(target, event->name);
+            if (watch == NULL) {
+                return ERROR;
+            }
+            watch->due = due;
+            return SUCCESS;
+        }
+        for (int i = 0; i < watchCount && (event->mask & IN_MOVED_FROM); ++i) {
+            if (watches[i].name != NULL && !strcmp(watches[i].name, event->name)) {
+                inotify_rm_watch(watchFD, watches[i].wd);
+                dropWatch(&watches[i]);
+                break;
+            }
+        }
+        char **grown = realloc(removedNames, (removedCount + 1) * sizeof(char *));
+        if (grown == NULL || (grown[removedCount] = strdup(event->name)) == NULL) {
+            print("Error in: strdup\n");
+            removedNames = grown != NULL ? grown : removedNames;
             return ERROR;
         }
-        return FAILURE;
+        removedNames = grown;
+        ++removedCount;
+        removedDue = due;
+        return SUCCESS;
     }
 
-    // Handle the edge-case where C file was found, execution was successful, but for some
-    // reason the binary file is not created.
-    if (writeToCSV(name, "10" ,"COMPILATION_ERROR") == ERROR) {
-        return ERROR;
+    // A submission changed, or its watch is gone.
+    Watch *watch = findWatch(event->wd);
+    if (watch == NULL || watch->name == NULL) {
+        return SUCCESS;
+    }
+    if (event->mask & IN_IGNORED) {
+        dropWatch(watch);
+    } else {
+        watch->due = due;
     }
+    return SUCCESS;
 
-    // Return 4 for failure for any other unexpected case.
-    return FAILURE;
-    
 }
 
 /**********************************************************************************
-* Function:     runProgram
-* Input:        Current directory name and path to input file.
-* Output:       Return 0 for success, -1 for error or 124 for time-out.
-* Operation:    This function creates the arguments to run the compiled program in
-*               the current sub-directory (if found and successfully compiled).
-*               then it run it and return status. It write to the CSV if timed-out.
+* Function:     updateResults
+* Input:        A results file of some of the submissions (NULL for none), and the
+*               names of the submissions to remove, with their number.
+* Output:       0 for success, -1 for error.
+* Operation:    Replaces the rows of the results file of the run with the rows of
+*               the same submissions in the given file, removes the rows of the
+*               removed submissions, and adds the rows of the new submissions at
+*               its end. The new results file is written next to the old one and
+*               renamed over it, so it is never read half written.
 ***********************************************************************************/
-int runProgram(const char *name, const char *inputFile) {
-
-    // Create command for execvp() -- set timeout for 5 seconds.
-    char *command[] = {"timeout", "5s", BINARY, NULL};
+int updateResults(const char *path, char **removed, int removedTotal) {
 
-    // Compile program using execute() function (that uses fork() and execvp()).
-    int status = execute(command, inputFile);
+    // Read both files, and sort the new rows and the keys of the removed rows to look them up.
+    Row *rows = NULL, *updates = NULL;
+    size_t count = 0, capacity = 0, updateCount = 0, updateCapacity = 0;
+    int status = SUCCESS;
+    if (readShard(resultsFile, &rows, &count, &capacity) == ERROR
+        || (path != NULL && readShard(path, &updates, &updateCount, &updateCapacity) == ERROR)) {
+        status = ERROR;
+    }
+    qsort(updates, updateCount, sizeof(Row), compareRows);
+    char **removedKeys = calloc(removedTotal ? removedTotal : 1, sizeof(char *));
+    for (int i = 0; i < removedTotal && removedKeys != NULL; ++i) {
+        removedKeys[i] = resultsFormat == FORMAT_CSV ? strdup(removed[i]) : quoteJSON(removed[i]);
+        status = removedKeys[i] == NULL ? ERROR : status;
+    }
+    if (removedKeys == NULL) {
+        print("Error in: calloc\n");
+        status = ERROR;
+    } else {
+        qsort(removedKeys, removedTotal, sizeof(char *), compareNames);
+    }
 
-    // Write to the CSV if operation was timed-out.
-    if (status == TIMED_OUT) {
-        if (writeToCSV(name, "20", "TIMEOUT") == ERROR) {
-            return ERROR;
+    // Write the rows in their order, each replaced by its new row if it has one, then the rest of the new rows.
+    char next[PATH_MAX];
+    snprintf(next, sizeof(next), "%s.next", resultsFile);
+    if (status == SUCCESS && (safeRemove(next) == ERROR || openSink(next) == ERROR)) {
+        status = ERROR;
+    }
+    if (status == SUCCESS) {
+        for (size_t i = 0; i < count && status == SUCCESS; ++i) {
+            Row *update = bsearch(&rows[i], updates, updateCount, sizeof(Row), compareRows);
+            if (update == NULL) {
+                if (bsearch(&rows[i].key, removedKeys, removedTotal, sizeof(char *), compareNames) == NULL) {
+                    status = appendToSink("%s\n", rows[i].line);
+                }
+            } else if (update->line != NULL) {
+                status = appendToSink("%s\n", update->line);
+                free(update->line);
+                update->line = NULL;
+            }
+        }
+        for (size_t i = 0; i < updateCount && status == SUCCESS; ++i) {
+            if (updates[i].line != NULL) {
+                status = appendToSink("%s\n", updates[i].line);
+            }
+        }
+        if (closeSink() == ERROR) {
+            status = ERROR;
+        }
+        if (status == SUCCESS && rename(next, resultsFile) == ERROR) {
+            print("Error in: rename\n");
+            status = ERROR;
         }
     }
 
-    // Return 0 for success, -1 for error and 4 for failure.
+    // Release the rows.
+    for (size_t i = 0; i < count; ++i) {
+        free(rows[i].key);
+        free(rows[i].line);
+    }
+    for (size_t i = 0; i < updateCount; ++i) {
+        free(updates[i].key);
+        free(updates[i].line);
+    }
+    for (int i = 0; i < removedTotal && removedKeys != NULL; ++i) {
+        free(removedKeys[i]);
+    }
+    free(rows);
+    free(updates);
+    free(removedKeys);
     return status;
 
 }
 
 /**********************************************************************************
-* Function:     testOutput
-* Input:        Current file's name and sharedAccess.
-* Output:       The return value of ex31.c (1, 2 or 3), or -1 for error.
-* Operation:    This function tests the output using ex31.c program and write
-*               write the result to results.csv file. The function return ex31.c
-*               return value or -1 if an error occured.
+* Function:     gradeChanges
+* Input:        Target directory, the test cases, and the number of workers.
+* Output:       0 for success, -1 for failure.
+* Operation:    Grades the submissions that are due (see handleEvent()) -- those
+*               that are still there -- into a results file of their own, then
+*               updates their rows in the results file of the run. Once the
+*               removed submissions are due, the rows of those that didn't come
+*               back are removed along the way.
 ***********************************************************************************/
-int testOutput(const char *name, const char *correctOutputFile) {
-
-    // Make a copy to avoid 'const' warning message.
-    char correctFileCopy[strlen(correctOutputFile)];
-    strcpy(correctFileCopy, correctOutputFile);
+int gradeChanges(const char *target, const TestCase *cases, int caseCount, int jobs) {
 
-    // Create command for execvp() -- to use comp.out (ex31.c) program.
-    char *command[] = {COMP, OUTPUT, correctFileCopy, NULL};
+    // Find the C files of the due submissions.
+    int targetFD = open(target, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (targetFD == ERROR) {
+        print("Not a valid directory\n");
+        return ERROR;
+    }
+    Submission *submissions = malloc((watchCount ? watchCount : 1) * sizeof(Submission));
+    if (submissions == NULL) {
+        print("Error in: malloc\n");
+        close(targetFD);
+        return ERROR;
+    }
+    long now = elapsedMs(&watchStart);
+    int count = 0;
+    for (int i = 0; i < watchCount; ++i) {
+        struct stat pathStat;
+        if (watches[i].name == NULL || watches[i].due == 0 || watches[i].due > now) {
+            continue;
+        }
+        watches[i].due = 0;
+        if (fstatat(targetFD, watches[i].name, &pathStat, 0) == ERROR || !S_ISDIR(pathStat.st_mode)) {
+            continue;
+        }
+        submissions[count] = (Submission){.name = watches[i].name, .source = NULL};
+        if (findSource(targetFD, &submissions[count]) == SUCCESS) {
+            ++count;
+        }
+    }
 
-    // Test using execute().
-    int status = execute(command, NULL);
+    // Keep the removed submissions that are gone for good.
+    int removals = 0;
+    for (int i = 0; i < removedCount && removedDue <= now; ++i) {
+        struct stat pathStat;
+        if (fstatat(targetFD, removedNames[i], &pathStat, 0) == ERROR) {
+            removedNames[removals++] = removedNames[i];
+        } else {
+            free(removedNames[i]);
+        }
+    }
+    removedCount = removedDue <= now ? 0 : removedCount;
+    close(targetFD);
 
-    // Write result to results.csv and return status code.
-    // Return -1 for error in case of an unexpected result.
-    switch (status) {
-        case IDENTICAL: return writeToCSV(name, "100", "EXCELLENT");
-        case DIFFERENT: return writeToCSV(name, "50", "WRONG");
-        case SIMILAR:   return writeToCSV(name, "75", "SIMILAR");
-        default:        return ERROR;
+    // Grade them, and update their rows.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.round", resultsFile);
+    int status = safeRemove(path);
+    if (status == SUCCESS && count > 0) {
+        status = gradeBatch(target, submissions, count, cases, caseCount, jobs, path);
     }
-    
+    if (status == SUCCESS && (count > 0 || removals > 0)) {
+        status = updateResults(count > 0 ? path : NULL, removedNames, removals);
+        char report[64];
+        snprintf(report, sizeof(report), "Watch: %d graded, %d removed\n", count, removals);
+        print(report);
+    }
+    if (safeRemove(path) == ERROR) {
+        status = ERROR;
+    }
+    for (int i = 0; i < removals; ++i) {
+        free(removedNames[i]);
+    }
+    for (int i = 0; i < count; ++i) {
+        free(submissions[i].source);
+    }
+    free(submissions);
+    return status;
+
 }
 
 /**********************************************************************************
-* Function:     runTest
-* Input:        Target directory, input file location, and output file location.
-* Output:       0 for success, -1 for failure.
-* Operation:    This is the main test function. It verifies existance of necessary
-*               files, open the target directory, and for each directory entry it
-*               finds, it does 3 things:
-*                   1) Look for a C file and compile it (with findAndCompile()).
-*                   2) Try to run the binary for 5 seconds (with runProgram()).
-*                   3) Compare the output with the correct onr (with testOutput()).
-*               Each and every operation is checked, and the function returns -1
-*               if any significant error occured.
+* Function:     watchSubmissions
+* Input:        Target directory, the test cases, and the number of workers.
+* Output:       -1 for failure (it returns on failure only).
+* Operation:    The body of --watch. It watches the target directory and every
+*               submission's directory with inotify, grades all of them (see
+*               runTest()), then waits for changes and grades the submissions
+*               that changed once they stay unchanged for WATCH_QUIET ms (see
+*               gradeChanges()). The watches are set before the first run, so
+*               nothing that changes during it is missed. Only the first run
+*               reuses and replaces the manifest of --incremental, as the rows of
+*               the later runs are kept in the results file instead.
 ***********************************************************************************/
-int runTest(const char *target, const char *inputFile, const char *correctOutputFile) {
-    
-    // Try to open the target directory.
-    DIR *dir = opendir(target);
-    if (!dir) {
-        print("Not a valid directory\n");
+int watchSubmissions(const char *target, const TestCase *cases, int caseCount, int jobs) {
+
+    // Watch the target directory and the directories of the submissions.
+    clock_gettime(CLOCK_MONOTONIC, &watchStart);
+    if ((watchFD = inotify_init1(IN_CLOEXEC)) == ERROR) {
+        print("Error in: inotify_init1\n");
         return ERROR;
     }
-
-    // Initialize status flag variable.
-    int status;
-
-    // Traverse sub-directories and do the job.
-    struct dirent *dirEnt;
-    while ((dirEnt = readdir(dir)) != NULL) {
-
-        // Save directory name in a variable for convenience reason.
-        const char *name = dirEnt->d_name;
-
-        // Avoid current and previous directories references.
-        if (!strcmp(name, ".") || !strcmp(name, "..")) {
-            continue;
+    int targetEvents = IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR;
+    if ((targetWatch = inotify_add_watch(watchFD, target, targetEvents)) == ERROR) {
+        print("Error in: inotify_add_watch\n");
+        return ERROR;
+    }
+    Submission *submissions;
+    int count, status = collectSubmissions(target, &submissions, &count, 0);
+    for (int i = 0; i < count && status == SUCCESS; ++i) {
+        if (addWatch(target, submissions[i].name) == NULL) {
+            status = ERROR;
         }
+    }
+    releaseSubmissions(submissions, count);
 
-        // Create a path to the next directory.
-        char path[PATH_MAX];
-        strcpy(path, target);
-        strcat(path, "/");
-        strcat(path, dirEnt->d_name);
+    // Grade everything once.
+    if (status == ERROR || runTest(target, cases, caseCount, jobs) == ERROR) {
+        return ERROR;
+    }
+    stateDirectory = NULL;
 
-        // Create stat to identify directory entry type.
-        struct stat pathStat;
-        if (stat(path, &pathStat) == ERROR) {
-            return ERROR;
-        }
+    // Wait for changes, and grade the submissions that changed once they are due.
+    _Alignas(struct inotify_event) char buffer[WATCH_BUFFER];
+    for (;;) {
 
-        // Engage only directories.
-        if (!S_ISDIR(pathStat.st_mode)) {
-            continue;
+        // Sleep until the next submission is due (or forever, if none is).
+        long next = removedCount > 0 ? removedDue : -1;
+        for (int i = 0; i < watchCount; ++i) {
+            if (watches[i].due != 0 && (next == -1 || watches[i].due < next)) {
+                next = watches[i].due;
+            }
         }
-
-        // Look for a C file in the sub-directory and compile it. Return Error (-1) if needed. 
-        status = findAndCompile(name, path);
-        if (status == ERROR) {
-            closedir(dir);
+        long timeout = next == -1 ? -1 : next - elapsedMs(&watchStart);
+        struct pollfd watchPoll = {.fd = watchFD, .events = POLLIN};
+        int ready = timeout == -1 || timeout > 0 ? poll(&watchPoll, 1, timeout) : 0;
+        if (ready == ERROR && errno != EINTR) {
+            print("Error in: poll\n");
             return ERROR;
         }
 
-        // If a C file was found and successfully compiled, try to run its binary with the given input file.
-        if (status == SUCCESS) {
-            status = runProgram(name, inputFile);
-            if (status == ERROR) {
-                closedir(dir);
+        // Take in the events.
+        if (ready > 0) {
+            ssize_t received = read(watchFD, buffer, sizeof(buffer));
+            if (received == ERROR && errno != EINTR) {
+                print("Error in: read\n");
                 return ERROR;
             }
-            // If the program ran succesfully, compare its output to the given correct output file.
-            if (status == SUCCESS) {
-                status = testOutput(name, correctOutputFile);
-                if (status == ERROR) {
-                    closedir(dir);
+            for (ssize_t offset = 0; offset < received;) {
+                const struct inotify_event *event = (const struct inotify_event *)(buffer + offset);
+                if (handleEvent(target, event) == ERROR) {
                     return ERROR;
                 }
+                offset += sizeof(struct inotify_event) + event->len;
             }
         }
 
-        // Cleanup - remove redundent files.
-        if (safeRemove(BINARY) == ERROR || safeRemove(OUTPUT) == ERROR) {
+        // Grade what is due.
+        if (next != -1 && next <= elapsedMs(&watchStart)
+            && gradeChanges(target, cases, caseCount, jobs) == ERROR) {
             return ERROR;
         }
 
     }
 
-    // Close target directory.
-    if (closedir(dir) == ERROR) {
-        return ERROR;
-    }
-
-    // Return 0, which means success.
-    return SUCCESS;
-    
 }
 
 /**********************************************************************************
-* Function:     setupChecks
-* Input:        Target directory, input file location, and output file location.
-* Output:       0 for success, -1 for failure.
-* Operation:    This function remove old errors.txt and results.csv files and
-*               verifies that the given target directory, input file, and correct
-*               output file are exists and from the correct types.
+* Function:     main
+* Input:        argc, argv -- standard input:
+*               [-j N] [-u] [-f] [-o MB] [-c DIR [-s MB]]
+*               [-F csv|jsonl] [-b ROWS] [-i MS] [-S] [--shard I/N]
+*               [--memory MB] [--cpu S] [--processes N] [--file-size MB]
+*               [--open-files N] [--trace FILE] <configuration file>, or merge [-F csv|jsonl] N
+*               <configuration file> (see mergeShards()).
+* Output:       0 if finished properly, or exit with code -1 if a problem occured.
+* Operation:    Entry point of the program. -j sets the number of workers that
+*               grade in parallel, and defaults to the number of online cores.
+*               -u adds the resource usage of each program to results.csv.
+*               -f stops grading a submission at its first failing test case.
+*               -o sets the output limit of a program in MB (64 by default).
+*               -F picks the results format -- csv (results.csv, the default) or
+*               jsonl (results.jsonl). -b and -i set how many rows (64) or
+*               milliseconds (1000) may pass between writes of the results, and
+*               -S syncs the results to the disk on every write.
+*               -c keeps a compilation cache in DIR, bounded to -s MB (256 by
+*               default). --shard grades only shard I (from 0) of N, picked by a
+*               hash of the submission's name, into results.IofN.csv and
+*               errors.IofN.txt, for hosts that split one run. --memory,
+*               --cpu, --processes, --file-size and --open-files limit every
+*               student's program (512 MB, none, none, 64 MB and 64 by default,
+*               0 for none). --trace writes a Chrome trace of every phase of every
+*               submission to FILE, and prints a summary of the phases. --watch
+*               keeps running after grading everything, and grades submissions
+*               again as they change (see watchSubmissions()). --rules sets what
+*               a SIMILAR output may differ in (see setNormalization()).
+*               --reference calibrates the time limit of every case on a
+*               reference solution instead of 5 seconds (see calibrateTimeouts()):
+*               it runs --reference-runs times (5), and a program gets
+*               --timeout-factor times its median wall time (3), at least
+*               --timeout-floor ms (200) and at most --timeout-ceiling ms (30000).
 ***********************************************************************************/
-int setupChecks(const char *directory, const char *input, const char *correct) {
+int main(int argc, char **argv) {
 
-    // Remove old files if exists.
-    if (safeRemove(ERRORS) == ERROR || safeRemove(RESULTS) == ERROR) {
-        return ERROR;
+    // Merge the results of shards, if asked to.
+    if (argc > 1 && !strcmp(argv[1], "merge")) {
+        if (mergeShards(argc - 1, argv + 1) != SUCCESS) {
+            exit(ERROR);
+        }
+        return SUCCESS;
     }
 
-    // Create stat to identify entry type.
-    struct stat entry;
+    // Parse options.
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *rules = NORMALIZATION_DEFAULT;
+    int option;
+    const struct option longOptions[] = {
+        {"shard", required_argument, NULL, OPTION_SHARD},
+        {"memory", required_argument, NULL, OPTION_MEMORY},
+        {"cpu", required_argument, NULL, OPTION_CPU},
+        {"processes", required_argument, NULL, OPTION_PROCESSES},
+        {"file-size", required_argument, NULL, OPTION_FILE_SIZE},
+        {"open-files", required_argument, NULL, OPTION_OPEN_FILES},
+        {"trace", required_argument, NULL, OPTION_TRACE},
+        {"launcher", required_argument, NULL, OPTION_LAUNCHER},
+        {"incremental", required_argument, NULL, OPTION_INCREMENTAL},
+        {"memfd", no_argument, NULL, OPTION_MEMFD},
+        {"watch", no_argument, NULL, OPTION_WATCH},
+        {"rules", required_argument, NULL, OPTION_RULES},
+        {"reference", required_argument, NULL, OPTION_REFERENCE},
+        {"reference-runs", required_argument, NULL, OPTION_REFERENCE_RUNS},
+        {"timeout-factor", required_argument, NULL, OPTION_TIMEOUT_FACTOR},
+        {"timeout-floor", required_argument, NULL, OPTION_TIMEOUT_FLOOR},
+        {"timeout-ceiling", required_argument, NULL, OPTION_TIMEOUT_CEILING},
+        {NULL, 0, NULL, 0}
+    };
+    while ((option = getopt_long(argc, argv, "j:ufo:c:s:F:b:i:S", longOptions, NULL)) != -1) {
+        if (option == 'j') {
+            jobs = strtol(optarg, NULL, 10);
+        } else if (option == 'u') {
+            usageColumns = 1;
+        } else if (option == 'f') {
+            failFast = 1;
+        } else if (option == 'o') {
+            outputLimit = strtol(optarg, NULL, 10) << 20;
+        } else if (option == 'c') {
+            cacheDirectory = optarg;
+        } else if (option == 's') {
+            cacheLimit = (off_t)strtol(optarg, NULL, 10) << 20;
+        } else if (option == 'F' && (!strcmp(optarg, "csv") || !strcmp(optarg, "jsonl"))) {
+            resultsFormat = !strcmp(optarg, "csv") ? FORMAT_CSV : FORMAT_JSONL;
+            resultsFile = resultsFormat == FORMAT_CSV ? RESULTS : RESULTS_JSONL;
+        } else if (option == 'b') {
+            flushRows = strtol(optarg, NULL, 10);
+        } else if (option == 'i') {
+            flushInterval = strtol(optarg, NULL, 10);
+        } else if (option == 'S') {
+            syncResults = 1;
+        } else if (option == OPTION_SHARD) {
+            if (sscanf(optarg, "%d/%d", &shardIndex, &shardCount) != 2 || shardIndex < 0
+                || shardIndex >= shardCount) {
+                print(USAGE);
+                exit(ERROR);
+            }
+        } else if (option == OPTION_MEMORY) {
+            limits.memory = (rlim_t)strtol(optarg, NULL, 10) << 20;
+        } else if (option == OPTION_CPU) {
+            limits.cpu = strtol(optarg, NULL, 10);
+        } else if (option == OPTION_PROCESSES) {
+            limits.processes = strtol(optarg, NULL, 10);
+        } else if (option == OPTION_FILE_SIZE) {
+            limits.fileSize = (rlim_t)strtol(optarg, NULL, 10) << 20;
+        } else if (option == OPTION_OPEN_FILES) {
+            limits.openFiles = strtol(optarg, NULL, 10);
+        } else if (option == OPTION_TRACE) {
+            traceFile = optarg;
+        } else if (option == OPTION_LAUNCHER && (!strcmp(optarg, "spawn") || !strcmp(optarg, "fork"))) {
+            launcher = !strcmp(optarg, "spawn") ? LAUNCH_SPAWN : LAUNCH_FORK;
+        } else if (option == OPTION_INCREMENTAL) {
+            stateDirectory = optarg;
+        } else if (option == OPTION_MEMFD) {
+            diskless = 1;
+        } else if (option == OPTION_WATCH) {
+            watching = 1;
+        } else if (option == OPTION_RULES && setNormalization(optarg) == SUCCESS) {
+            rules = optarg;
+        } else if (option == OPTION_REFERENCE) {
+            referenceSource = optarg;
+        } else if (option == OPTION_REFERENCE_RUNS) {
+            referenceRuns = strtol(optarg, NULL, 10);
+        } else if (option == OPTION_TIMEOUT_FACTOR) {
+            timeoutFactor = strtod(optarg, NULL);
+        } else if (option == OPTION_TIMEOUT_FLOOR) {
+            timeoutFloor = strtol(optarg, NULL, 10);
+        } else if (option == OPTION_TIMEOUT_CEILING) {
+            timeoutCeiling = strtol(optarg, NULL, 10);
+        } else {
+            print(USAGE);
+            exit(ERROR);
+        }
+    }
 
-    // Verify target dictionary existance and type.
-    if (access(directory, F_OK) != SUCCESS || stat(directory, &entry) == ERROR || !S_ISDIR(entry.st_mode)) {
-        print("Not a valid directory\n");
-        return ERROR;
+    // A shard writes files of its own, so shards that share a directory don't collide.
+    if (shardCount > 1) {
+        snprintf(shardResults, sizeof(shardResults),
+                 resultsFormat == FORMAT_CSV ? SHARD_RESULTS : SHARD_RESULTS_JSONL, shardIndex, shardCount);
+        snprintf(shardErrors, sizeof(shardErrors), SHARD_ERRORS, shardIndex, shardCount);
+        resultsFile = shardResults;
+        errorsFile = shardErrors;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (referenceRuns < 1) {
+        referenceRuns = 1;
+    }
+    if (optind >= argc) {
+        print(USAGE);
+        exit(ERROR);
     }
 
-    // Verify input file existance and type.
-    if (access(input, F_OK) != SUCCESS || stat(input, &entry) == ERROR || !S_ISREG(entry.st_mode)) {
-        print("Input file not exist\n");
-        return ERROR;
+    // Find where the memory cgroups of the programs can be made, so running out of memory is told apart.
+    if (limits.memory && setupMemoryGroups() == ERROR) {
+        print("Memory limit: no memory cgroup to run programs in, running out of memory is graded as a crash\n");
     }
 
-    // Verify output file existance.
-    if (access(correct, F_OK) != SUCCESS|| stat(correct, &entry) == ERROR || !S_ISREG(entry.st_mode)) {
-        print("Output file not exist\n");
-        return ERROR;
+    // Read the configuration file.
+    char *targetDirectory;
+    TestCase *cases;
+    int count;
+    if (loadConfiguration(argv[optind], &targetDirectory, &cases, &count) == ERROR) {
+        exit(ERROR);
     }
 
-    // Return 0 if all checked.
-    return SUCCESS;
+    if (setupChecks(targetDirectory, cases, count) == ERROR) {
+        return ERROR;
+    }
 
-}
+    // Workers run in their own scratch directories, so they need absolute paths.
+    char *targetPath = realpath(targetDirectory, NULL);
+    if (targetPath == NULL) {
+        print("Error in: realpath\n");
+        exit(ERROR);
+    }
+    for (int i = 0; i < count; ++i) {
+        if ((cases[i].input = realpath(cases[i].input, NULL)) == NULL) {
+            print("Error in: realpath\n");
+            exit(ERROR);
+        }
+    }
 
-/**********************************************************************************
-* Function:     main
-* Input:        argc, argv -- standard input.
-* Output:       0 if finished properly, or exit with code -1 if a problem occured.
-* Operation:    Entry point of the program.
-***********************************************************************************/
-int main(int argc, char **argv) {
+    // Load every input once into a sealed memory file (with --memfd), which every run opens as its input
+    // through its /proc/self/fd path -- each open starts at its beginning.
+    for (int i = 0; diskless && i < count; ++i) {
+        if (loadInput(&cases[i]) == ERROR) {
+            exit(ERROR);
+        }
+    }
 
-    // Open configuration file.
-    int fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
-        print("Error in: open\n");
-        exit(ERROR);
+    // Load every correct output once, so every output is compared to it in memory.
+    for (int i = 0; i < count; ++i) {
+        int correctFD = open(cases[i].correct, O_RDONLY);
+        if (correctFD < 0) {
+            print("Error in: open\n");
+            exit(ERROR);
+        }
+        if (loadReference(&cases[i].correctOutput, correctFD) == ERROR) {
+            print("Error in: read\n");
+            close(correctFD);
+            exit(ERROR);
+        }
+        close(correctFD);
     }
 
-    // Set buffer and read configuration file.
-    char buffer[CONF_MAX];
-    if (read(fd, buffer, CONF_MAX) == ERROR) {
-        print("Error in: read\n");
-        close(fd);
+    // Calibrate the time limits on the reference solution (if asked to).
+    if (referenceSource != NULL && calibrateTimeouts(cases, count) == ERROR) {
         exit(ERROR);
     }
 
-    // Close configuration file descriptor.
-    if (close(fd) == ERROR) {
-        print("Error in: close\n");
+    // Make room for the verdict of every case.
+    caseTotal = count;
+    caseReasons = calloc(count, sizeof(char *));
+    caseOutputs = calloc(count, sizeof(uint64_t));
+    if (caseReasons == NULL || caseOutputs == NULL) {
+        print("Error in: malloc\n");
         exit(ERROR);
     }
 
+    // Set up the compilation cache (if asked to) -- also by an absolute path.
+    if (cacheDirectory != NULL) {
+        mkdir(cacheDirectory, S_IRWXU);
+        if ((cacheDirectory = realpath(cacheDirectory, NULL)) == NULL) {
+            print("Error in: realpath\n");
+            exit(ERROR);
+        }
+        if (findCompilerIdentity(COMPILER) == ERROR) {
+            exit(ERROR);
+        }
+    }
 
-    // Extract information from the configuration file.
-    char *targetDirectory = strtok(buffer, "\n");
-    char *inputFile = strtok(NULL, "\n");
-    char *correctFile = strtok(NULL, "\n");
-
-    if (setupChecks(targetDirectory, inputFile, correctFile) == ERROR) {
-        return ERROR;
+    // Set up the state directory (if asked to) -- by an absolute path too -- and read the last manifest. The
+    // grades depend on the compiler and the limits as well as on the submissions and the cases. Calibrated time
+    // limits vary from run to run, so the reference solution and the settings they follow from are hashed instead.
+    if (stateDirectory != NULL) {
+        char path[PATH_MAX];
+        mkdir(stateDirectory, S_IRWXU);
+        if ((stateDirectory = realpath(stateDirectory, NULL)) == NULL) {
+            print("Error in: realpath\n");
+            exit(ERROR);
+        }
+        snprintf(path, sizeof(path), "%s" KEPT_OUTPUTS, stateDirectory);
+        mkdir(path, S_IRWXU);
+        if (compilerIdentity[0] == '\0' && findCompilerIdentity(COMPILER) == ERROR) {
+            exit(ERROR);
+        }
+        long timeLimit = TIME_LIMIT;
+        int grouped = memoryGroups != NULL;
+        manifestSettings = hashBytes(FNV_OFFSET, compilerIdentity, strlen(compilerIdentity));
+        manifestSettings = hashBytes(manifestSettings, &limits, sizeof(limits));
+        manifestSettings = hashBytes(manifestSettings, limitResources, sizeof(limitResources));
+        manifestSettings = hashBytes(manifestSettings, &grouped, sizeof(grouped));
+        manifestSettings = hashBytes(manifestSettings, &outputLimit, sizeof(outputLimit));
+        manifestSettings = hashBytes(manifestSettings, &timeLimit, sizeof(timeLimit));
+        manifestSettings = hashBytes(manifestSettings, &failFast, sizeof(failFast));
+        manifestSettings = hashBytes(manifestSettings, rules, strlen(rules));
+        if (referenceSource != NULL) {
+            manifestSettings = hashFile(referenceSource, manifestSettings);
+            manifestSettings = hashBytes(manifestSettings, &timeoutFactor, sizeof(timeoutFactor));
+            manifestSettings = hashBytes(manifestSettings, &timeoutFloor, sizeof(timeoutFloor));
+            manifestSettings = hashBytes(manifestSettings, &timeoutCeiling, sizeof(timeoutCeiling));
+        }
+        for (int i = 0; i < count; ++i) {
+            cases[i].inputHash = hashFile(cases[i].input, FNV_OFFSET);
+            const Reference *correct = &cases[i].correctOutput;
+            cases[i].correctHash = hashBytes(FNV_OFFSET, correct->data, correct->length);
+        }
+        if (loadManifest(cases, count) == ERROR) {
+            exit(ERROR);
+        }
     }
 
-    // Run test -- find C files, compile each of them, run and test outputs.
-    int status = runTest(targetDirectory, inputFile, correctFile);
+    // Run test -- find C files, compile each of them, run and test outputs (and keep doing so as they change,
+    // if asked to).
+    int status = watching ? watchSubmissions(targetPath, cases, count, jobs)
+                          : runTest(targetPath, cases, count, jobs);
+    for (int i = 0; i < count; ++i) {
+        releaseReference(&cases[i].correctOutput);
+        free(cases[i].input);
+    }
+    free(cases);
+    free(caseReasons);
+    free(caseOutputs);
+    free(targetPath);
+    free(cacheDirectory);
 
     // If unexpected error will occur, runTest() will return -1, and the main will exit with code -1.
     if (status != SUCCESS) {
@@ -591,4 +4661,4 @@ int main(int argc, char **argv) {
     // Done.
     return SUCCESS;
 
-}
\ No newline at end of file
+}
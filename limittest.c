@@ -0,0 +1,324 @@
+// Shlomi Ben-Shushan
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Defines status codes.
+#define SUCCESS     0
+#define ERROR       -1
+
+// Defines the files of a test tree, relative to its directory.
+#define TREE    "./limittest.XXXXXX"    // mkdtemp() template of the tree, unless -d names one.
+#define INPUT   "input.txt"
+#define CORRECT "correct.txt"
+#define CONFIG  "conf.txt"
+#define SUMMARY "summary.txt"           // What ex32 prints.
+#define RESULTS "results.csv"
+
+// Defines the limits ex32 runs the programs under (see --memory, --cpu and --file-size), and what it
+// prints when it has no memory cgroup to tell running out of memory by.
+#define LIMITS          {"--memory", "64", "--cpu", "1", "--file-size", "1", "-j", "1"}
+#define NO_MEMORY_GROUP "Memory limit: no memory cgroup"
+
+// Defines the command line synopsis.
+#define USAGE   "Usage: limittest [-e EX32] [-d DIR]\n"
+
+/**********************************************************************************
+* Struct:       LimitCase
+* Operation:    A submission -- its name and program -- and the verdict ex32 must
+*               give it, with a memory cgroup and without one.
+***********************************************************************************/
+typedef struct {
+    const char *name;
+    const char *program;
+    const char *expected;
+    const char *ungrouped;
+} LimitCase;
+
+// The submissions. The correct output is "ok". hog allocates and touches 1 GB in blocks of 16 MB, and
+// quits quietly if an allocation fails -- its memory cgroup kills it, while RLIMIT_DATA only makes its
+// allocations fail. selfkill kills itself with SIGKILL, which is a crash and not a memory limit, and
+// crash writes to NULL. spin burns CPU time past --cpu, and flood writes past --file-size.
+const LimitCase limitCases[] = {
+    {"fine", "#include <stdio.h>\nint main() { puts(\"ok\"); }\n", "EXCELLENT", "EXCELLENT"},
+    {"hog", "#include <stdlib.h>\n#include <string.h>\n"
+            "int main() { for (int i = 0; i < 64; ++i) { char *p = malloc(16 << 20); if (!p) return 1; "
+            "memset(p, 1, 16 << 20); } return 0; }\n", "MEMORY_LIMIT", "WRONG"},
+    {"selfkill", "#include <signal.h>\nint main() { raise(SIGKILL); }\n", "WRONG", "WRONG"},
+    {"crash", "int main() { *(volatile int *)0 = 1; }\n", "WRONG", "WRONG"},
+    {"spin", "int main() { for (volatile long i = 0;; ++i) { } }\n", "CPU_LIMIT", "CPU_LIMIT"},
+    {"flood", "#include <stdio.h>\n"
+              "int main() { FILE *f = tmpfile(); for (int i = 0; i < 1 << 22; ++i) fputc('x', f); fclose(f); }\n",
+              "FILE_LIMIT", "FILE_LIMIT"}
+};
+
+/**********************************************************************************
+* Function:     print
+* Input:        String.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes the given string to the standard output.
+***********************************************************************************/
+int print(const char *msg) {
+    if (write(1, msg, strlen(msg)) == ERROR) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     writeFile
+* Input:        A path, a printf() format and its arguments.
+* Output:       0 for success, -1 for error.
+* Operation:    Creates the file (or truncates it) with the formatted text.
+***********************************************************************************/
+__attribute__((format(printf, 2, 3)))
+int writeFile(const char *path, const char *format, ...) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    int status = vfprintf(file, format, arguments) < 0 ? ERROR : SUCCESS;
+    va_end(arguments);
+    if (fclose(file) == EOF) {
+        status = ERROR;
+    }
+    return status;
+}
+
+/**********************************************************************************
+* Function:     generateTree
+* Input:        The tree's directory.
+* Output:       0 for success, -1 for error.
+* Operation:    Writes a configuration file, an input and its correct output, and
+*               a sub-directory for every submission of limitCases.
+***********************************************************************************/
+int generateTree(const char *directory) {
+    if (chdir(directory) == ERROR) {
+        print("Error in: chdir\n");
+        return ERROR;
+    }
+    if (writeFile(INPUT, "1\n") == ERROR || writeFile(CORRECT, "ok\n") == ERROR
+        || writeFile(CONFIG, "submissions\n%s\n%s\n", INPUT, CORRECT) == ERROR) {
+        return ERROR;
+    }
+    if (mkdir("submissions", S_IRWXU) == ERROR) {
+        print("Error in: mkdir\n");
+        return ERROR;
+    }
+    for (size_t i = 0; i < sizeof(limitCases) / sizeof(LimitCase); ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "submissions/%s", limitCases[i].name);
+        if (mkdir(path, S_IRWXU) == ERROR) {
+            print("Error in: mkdir\n");
+            return ERROR;
+        }
+        strcat(path, "/main.c");
+        if (writeFile(path, "%s", limitCases[i].program) == ERROR) {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     runGrader
+* Input:        The path of ex32.
+* Output:       0 for success, -1 for error.
+* Operation:    Runs ex32 under LIMITS on the tree (the working directory), with
+*               its output in SUMMARY.
+***********************************************************************************/
+int runGrader(const char *grader) {
+    char *limits[] = LIMITS;
+    int count = sizeof(limits) / sizeof(limits[0]);
+    char *command[count + 3];
+    command[0] = (char *)grader;
+    for (int i = 0; i < count; ++i) {
+        command[1 + i] = limits[i];
+    }
+    command[1 + count] = CONFIG;
+    command[2 + count] = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open(SUMMARY, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == ERROR || dup2(fd, 1) == ERROR) {
+            _exit(ERROR);
+        }
+        execvp(command[0], command);
+        print("Error in: execvp\n");
+        _exit(ERROR);
+    }
+    if (pid < 0) {
+        print("Error in: fork\n");
+        return ERROR;
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == ERROR) {
+        print("Error in: waitpid\n");
+        return ERROR;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != SUCCESS) {
+        print("ex32 failed, see " SUMMARY "\n");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**********************************************************************************
+* Function:     checkResults
+* Input:        None.
+* Output:       The number of submissions that didn't get their verdict, or -1
+*               for error.
+* Operation:    Reads whether ex32 had a memory cgroup from SUMMARY, and the
+*               verdict of every submission from RESULTS, and prints them as one
+*               JSON object in a line.
+***********************************************************************************/
+int checkResults(void) {
+
+    // Did ex32 have a memory cgroup?
+    char line[256];
+    int grouped = 1;
+    FILE *summary = fopen(SUMMARY, "r");
+    if (summary == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    while (fgets(line, sizeof(line), summary) != NULL) {
+        if (!strncmp(line, NO_MEMORY_GROUP, strlen(NO_MEMORY_GROUP))) {
+            grouped = 0;
+        }
+    }
+    fclose(summary);
+
+    // Read the verdicts -- the third column of every row.
+    size_t count = sizeof(limitCases) / sizeof(LimitCase);
+    char graded[count][32];
+    memset(graded, 0, sizeof(graded));
+    FILE *results = fopen(RESULTS, "r");
+    if (results == NULL) {
+        print("Error in: fopen\n");
+        return ERROR;
+    }
+    while (fgets(line, sizeof(line), results) != NULL) {
+        char *grade = strchr(line, ','), *reason = grade != NULL ? strchr(grade + 1, ',') : NULL;
+        if (reason == NULL) {
+            continue;
+        }
+        *grade = '\0';
+        reason[1 + strcspn(reason + 1, ",\n")] = '\0';
+        for (size_t i = 0; i < count; ++i) {
+            if (!strcmp(line, limitCases[i].name)) {
+                snprintf(graded[i], sizeof(graded[i]), "%s", reason + 1);
+            }
+        }
+    }
+    fclose(results);
+
+    // Compare and report.
+    int mismatches = 0;
+    printf("{\"memory_cgroup\":%s,\"submissions\":{", grouped ? "true" : "false");
+    for (size_t i = 0; i < count; ++i) {
+        const char *expected = grouped ? limitCases[i].expected : limitCases[i].ungrouped;
+        mismatches += strcmp(expected, graded[i]) != 0;
+        printf("%s\"%s\":{\"expected\":\"%s\",\"graded\":\"%s\"}", i ? "," : "", limitCases[i].name, expected,
+               graded[i]);
+    }
+    printf("},\"mismatches\":%d}\n", mismatches);
+    return mismatches;
+
+}
+
+/**********************************************************************************
+* Function:     removeEntry
+* Input:        nftw() style.
+* Output:       0 for success, -1 for error.
+* Operation:    Removes a file or an (already emptied) directory.
+***********************************************************************************/
+int removeEntry(const char *path, const struct stat *entry, int type, struct FTW *ftw) {
+    (void)entry;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/**********************************************************************************
+* Function:     main
+* Input:        argc, argv -- standard input: [-e EX32] [-d DIR].
+* Output:       0 if every submission got its verdict, -1 otherwise.
+* Operation:    End-to-end test of the resource limits of ex32. Generates a tree of
+*               the submissions of limitCases, grades it with EX32 (./a.out by
+*               default) under LIMITS, and checks every verdict (see
+*               checkResults()) -- a program that runs out of memory must be
+*               graded MEMORY_LIMIT where ex32 has a memory cgroup, and one that
+*               kills itself never. The tree is generated in a temporary
+*               directory and removed at the end, unless -d names a directory to
+*               generate it in and keep.
+***********************************************************************************/
+int main(int argc, char **argv) {
+
+    // Parse options.
+    const char *directory = NULL;
+    char *grader = "./a.out";
+    int option;
+    while ((option = getopt(argc, argv, "e:d:")) != -1) {
+        if (option == 'e') {
+            grader = optarg;
+        } else if (option == 'd') {
+            directory = optarg;
+        } else {
+            print(USAGE);
+            exit(ERROR);
+        }
+    }
+
+    // ex32 is run from the tree, so it needs an absolute path (unless it is found in PATH).
+    char graderPath[PATH_MAX];
+    if (strchr(grader, '/') != NULL) {
+        if (realpath(grader, graderPath) == NULL) {
+            print("Error in: realpath\n");
+            exit(ERROR);
+        }
+        grader = graderPath;
+    }
+
+    // Generate the tree, grade it and check the verdicts.
+    char tree[] = TREE, cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        print("Error in: getcwd\n");
+        exit(ERROR);
+    }
+    if (directory == NULL && mkdtemp(tree) == NULL) {
+        print("Error in: mkdtemp\n");
+        exit(ERROR);
+    }
+    if (directory != NULL && mkdir(directory, S_IRWXU) == ERROR) {
+        print("Error in: mkdir\n");
+        exit(ERROR);
+    }
+    int status = generateTree(directory != NULL ? directory : tree) == SUCCESS && runGrader(grader) == SUCCESS
+                 && checkResults() == SUCCESS ? SUCCESS : ERROR;
+
+    // Remove the temporary tree.
+    if (directory == NULL && (chdir(cwd) == ERROR || nftw(tree, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == ERROR)) {
+        print("Error in: nftw\n");
+        status = ERROR;
+    }
+    if (status != SUCCESS) {
+        exit(ERROR);
+    }
+    return SUCCESS;
+
+}